@@ -16,12 +16,27 @@
 #include <unistd.h>
 #include <time.h>
 #include <stdarg.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sched.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 
 #define MAX_LINE_LEN 1024
 #define MAX_GENE_LEN 100
 #define MAX_LOCATION_LEN 100
 #define MIN_SEQUENCE_LEN 10000
+#define MAX_FEATURE_NUM 100
+#define MAX_OPEN_FILES 64
+#define GENE_BUFFER_LEN 65536
 
 
 
@@ -29,32 +44,45 @@
 #define ERROR   "ERROR"
 #define WARNING "WARNING"
 
+// Last ERROR message of this thread, so the server can pass it on instead of exiting
+static __thread char last_error[MAX_LINE_LEN];
+
 void log_print(const char *level, const char *fmt, ...) {
     va_list args;
     time_t rawtime;
-    struct tm *timeinfo;
+    struct tm timeinfo;
 
     time(&rawtime);
-    timeinfo = localtime(&rawtime);
+    localtime_r(&rawtime, &timeinfo);
 
     char time_buffer[80];
-    strftime(time_buffer, 80, "%Y-%m-%d %H:%M:%S", timeinfo);
+    strftime(time_buffer, 80, "%Y-%m-%d %H:%M:%S", &timeinfo);
 
     fprintf(stderr, "[%s] %s: ", time_buffer, level);
     va_start(args, fmt);
     vfprintf(stderr, fmt, args);
     va_end(args);
     fprintf(stderr, "\n");
+    if (strcmp(level, ERROR) == 0) {
+        va_start(args, fmt);
+        vsnprintf(last_error, sizeof(last_error), fmt, args);
+        va_end(args);
+    }
 }
 
 
 // Function prototypes
 void print_usage(const char *prog_name) {
     fprintf(stdout, "Usage:%s -g <genbank_file> -a\n", prog_name);
+    fprintf(stdout, "      %s -b <genbank_list> -G -c -o <output_path>\n", prog_name);
+    fprintf(stdout, "      %s -b <genbank_list> -O -j <threads> -o <output_path>\n", prog_name);
+    fprintf(stdout, "      %s serve --socket <path> [--cache-size N]\n", prog_name);
     fprintf(stdout, "Required options:\n");
-    fprintf(stdout, "   -g, --genbank  Intput genbank file\n");
+    fprintf(stdout, "   -g, --genbank  Intput genbank file (.gb), or GFF3 annotation (.gff/.gff3)\n");
+    fprintf(stdout, "   -b, --batch    File listing one genbank file per line (instead of -g)\n");
 
     fprintf(stdout, "Optional options:\n");
+    fprintf(stdout, "   -s, --fasta  Genome fasta for GFF3 input without a ##FASTA section\n");
     fprintf(stdout, "   -pre, --prefix  Prefix of the output\n");
     fprintf(stdout, "   -a, --all    Flag to output all annotations\n");
     fprintf(stdout, "   -f, --faa    Flag to output fasta\n");
@@ -63,11 +91,25 @@ void print_usage(const char *prog_name) {
     fprintf(stdout, "   -t, --trn    Flag to output trn\n");
     fprintf(stdout, "   -r, --rrn    Flag to output rrn\n");
     fprintf(stdout, "   -o, --output The output path\n");
+    fprintf(stdout, "   -G, --by-gene  Write one fasta per gene (<gene>.fasta, <gene>.pep.fasta) across all inputs\n");
+    fprintf(stdout, "   -C, --cache    Skip inputs unchanged since the last run (manifest in <output>/.get_seq.cache)\n");
+    fprintf(stdout, "   -D, --dedup    With -G, write each distinct sequence of a gene once (members in <output>/dedup_members.tsv)\n");
+    fprintf(stdout, "   -Q, --qc       Write a QC report of every input parsed to <output>/qc_report.tsv\n");
+    fprintf(stdout, "   -O, --gene-order  Compare the gene order of all inputs instead of writing sequences\n");
+    fprintf(stdout, "                     (<output>/gene_order.tsv and <output>/gene_order_pairs.tsv)\n");
+    fprintf(stdout, "   -j, --threads  Number of threads parsing inputs and comparing gene orders (default: 1)\n");
     fprintf(stdout, "   -h, --help      Display this help message\n");
 }
 
 
-void parse_arguments(int argc, char *argv[], char *genbank_file, char *prefix, int *all_flag, int *faa_flag, int *pep_flag, int *cds_flag, int *trn_flag, int *rrn_flag, char *output_file) {
+// GFF3 input is recognised by its extension, everything else is read as genbank
+int is_gff_file(const char *path) {
+    const char *ext = strrchr(path, '.');
+    return ext != NULL && (strcmp(ext, ".gff") == 0 || strcmp(ext, ".gff3") == 0);
+}
+
+
+void parse_arguments(int argc, char *argv[], char *genbank_file, char *batch_file, char *fasta_file, char *prefix, int *all_flag, int *faa_flag, int *pep_flag, int *cds_flag, int *trn_flag, int *rrn_flag, int *by_gene_flag, int *cache_flag, int *dedup_flag, int *qc_flag, int *gene_order_flag, int *threads, char *output_file) {
     int i;
     for (i = 1; i < argc; i++) {
         if (strcmp(argv[i], "-g") == 0 || strcmp(argv[i], "--genbank") == 0) {
@@ -80,6 +122,40 @@ void parse_arguments(int argc, char *argv[], char *genbank_file, char *prefix, i
                 print_usage(argv[0]);
                 exit(EXIT_FAILURE);
             }
+        } else if (strcmp(argv[i], "-b") == 0 || strcmp(argv[i], "--batch") == 0) {
+            if (i + 1 < argc) {
+                strcpy(batch_file, argv[++i]);
+            } else {
+                log_print(ERROR, "Missing batch list argument");
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+        } else if (strcmp(argv[i], "-s") == 0 || strcmp(argv[i], "--fasta") == 0) {
+            if (i + 1 < argc) {
+                strcpy(fasta_file, argv[++i]);
+            } else {
+                log_print(ERROR, "Missing fasta file argument");
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+        } else if (strcmp(argv[i], "-G") == 0 || strcmp(argv[i], "--by-gene") == 0) {
+                *by_gene_flag = 1;
+        } else if (strcmp(argv[i], "-C") == 0 || strcmp(argv[i], "--cache") == 0) {
+                *cache_flag = 1;
+        } else if (strcmp(argv[i], "-D") == 0 || strcmp(argv[i], "--dedup") == 0) {
+                *dedup_flag = 1;
+        } else if (strcmp(argv[i], "-Q") == 0 || strcmp(argv[i], "--qc") == 0) {
+                *qc_flag = 1;
+        } else if (strcmp(argv[i], "-O") == 0 || strcmp(argv[i], "--gene-order") == 0) {
+                *gene_order_flag = 1;
+        } else if (strcmp(argv[i], "-j") == 0 || strcmp(argv[i], "--threads") == 0) {
+            if (i + 1 < argc && atoi(argv[i + 1]) > 0) {
+                *threads = atoi(argv[++i]);
+            } else {
+                log_print(ERROR, "Missing or invalid thread count");
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
         } else if (strcmp(argv[i], "-pre") == 0 || strcmp(argv[i], "--prefix") == 0) {
             if (i + 1 < argc) {
                 // *prefix = argv[++i];
@@ -114,14 +190,27 @@ void parse_arguments(int argc, char *argv[], char *genbank_file, char *prefix, i
         }
     }
 
-    if (strlen(genbank_file) == 0) {
+    if (strlen(genbank_file) == 0 && strlen(batch_file) == 0) {
         log_print(ERROR, "Please provide all required arguments");
         print_usage(argv[0]);
         exit(EXIT_FAILURE);
+    } else if (*dedup_flag == 1 && *by_gene_flag == 0) {
+        log_print(ERROR, "-D needs -G");
+        print_usage(argv[0]);
+        exit(EXIT_FAILURE);
+    } else if (*gene_order_flag == 1 && (*by_gene_flag == 1 || *cache_flag == 1)) {
+        log_print(ERROR, "-O cannot be combined with -G or -C");
+        print_usage(argv[0]);
+        exit(EXIT_FAILURE);
+    } else if (strlen(genbank_file) == 0) {
+        // batch mode: prefixes come from each input, the output path defaults to the working directory
+        if (strlen(output_file) == 0) {
+            strcpy(output_file, "./");
+        }
     } else {
         char *ext = strrchr(genbank_file, '.'); // get the extension of the file name
-        if (strcmp(ext, ".gb") != 0) { // check if the extension is ".gb"
-            log_print(ERROR, "Genbank file must have a extension (.gb)");
+        if (ext == NULL || (strcmp(ext, ".gb") != 0 && !is_gff_file(genbank_file))) { // check if the extension is ".gb" or ".gff3"
+            log_print(ERROR, "Genbank file must have a extension (.gb), or (.gff/.gff3) for GFF3 input");
             print_usage(argv[0]);
             exit(EXIT_FAILURE);
         } else {
@@ -161,7 +250,7 @@ void parse_arguments(int argc, char *argv[], char *genbank_file, char *prefix, i
     }
 
     if (*all_flag == 0 && *faa_flag == 0 && *pep_flag == 0 && *cds_flag == 0 && *trn_flag == 0 && *rrn_flag == 0) {
-        *all_flag = 1;
+        *all_flag = 1, *faa_flag = 1, *pep_flag = 1, *cds_flag = 1, *trn_flag = 1, *rrn_flag = 1;
     }
     
 }
@@ -172,6 +261,7 @@ typedef struct {
     char *gene;
     char *location;
     char *sequence;
+    int transl_table;   // /transl_table, 0 when the feature has none
 } Cds;
 
 // define a struct to store all the annotations
@@ -217,24 +307,26 @@ char* reverse_complement(char *seq) {
     return rc_seq;
 }
 
-// Function to extract a substring
+// Function to extract a substring, NULL when the 1-based range [start, end] is outside str
 char* subseq(const char* str, int start, int end) {
+    if (start < 1 || end < start || (size_t)end > strlen(str)) {
+        log_print(WARNING, "Invalid location '%d..%d' (sequence length %zu), feature skipped", start, end, strlen(str));
+        return NULL;
+    }
     start--;
     end--;
     int len = end - start + 1;
     char *sub = (char*)malloc((len + 1) * sizeof(char));
-    if (end >= strlen(str)) {
-        log_print(ERROR, "Invalid location '%d..%d'", start, end);
-        exit(EXIT_FAILURE);
-    }
     strncpy(sub, str + start, len);
     sub[len] = '\0';
     return sub;
 }
 
 
+// Sequence of a genbank location, NULL when part of it lies outside seq
 char* extract_sequence(char *seq, char *location) {
     int loclen = strlen(location);
+    int failed = 0;
     int join_flag = 0;
     int com_flag = 0;
     int cj_flag = 0;
@@ -310,11 +402,13 @@ char* extract_sequence(char *seq, char *location) {
                 sscanf(cp_loc, "%d..%d", &l_loc, &r_loc);
                 char *rc_subseq = subseq(seq, l_loc, r_loc);
                 // char *tk_subseq = malloc(strlen(rc_subseq) + 1);
-                tk_subseq = reverse_complement(rc_subseq);
+                free(tk_subseq);
+                tk_subseq = rc_subseq ? reverse_complement(rc_subseq) : NULL;
                 free(rc_subseq);
             } else {
                 int l_loc = 0, r_loc = 0;
                 sscanf(tk_loc, "%d..%d", &l_loc, &r_loc);
+                free(tk_subseq);
                 tk_subseq = subseq(seq, l_loc, r_loc);
             }
         } else {
@@ -323,18 +417,25 @@ char* extract_sequence(char *seq, char *location) {
             char cp_loc[strlen(tk_loc)];
             strcpy(cp_loc, tk_loc + 1);
             int l_loc = 0, r_loc = 0;
-            char *tokendot = strtok(cp_loc, ",");
+            char *saveptr = NULL;
+            char *tokendot = strtok_r(cp_loc, ",", &saveptr);
             while (tokendot != NULL) {
                 sscanf(tokendot, "%d..%d", &l_loc, &r_loc);
                 char *temp_subseq = subseq(seq, l_loc, r_loc);
+                if (temp_subseq == NULL) {
+                    failed = 1;
+                    break;
+                }
                 strcat(cm_subseq, temp_subseq);
                 free(temp_subseq);
-                tokendot = strtok(NULL, ",");
+                tokendot = strtok_r(NULL, ",", &saveptr);
             }
+            free(tk_subseq);
             tk_subseq =  reverse_complement(cm_subseq);
         }
     } else {
-        char *tokenspace = strtok(tk_loc, " ");
+        char *saveptr = NULL;
+        char *tokenspace = strtok_r(tk_loc, " ", &saveptr);
         while (tokenspace != NULL) {
             int l_loc = 0, r_loc = 0;
             // char *temp_subseq = NULL;
@@ -343,6 +444,10 @@ char* extract_sequence(char *seq, char *location) {
                 strcpy(cp_space, tokenspace + 1);
                 sscanf(cp_space, "%d..%d", &l_loc, &r_loc);
                 char *temp_subseq = subseq(seq, l_loc, r_loc);
+                if (temp_subseq == NULL) {
+                    failed = 1;
+                    break;
+                }
                 char *rc_temp_subseq = reverse_complement(temp_subseq);
                 strcat(tk_subseq, rc_temp_subseq);
                 free(temp_subseq);
@@ -350,37 +455,53 @@ char* extract_sequence(char *seq, char *location) {
             } else {
                 sscanf(tokenspace, "%d..%d", &l_loc, &r_loc);
                 char *temp_subseq = subseq(seq, l_loc, r_loc);
+                if (temp_subseq == NULL) {
+                    failed = 1;
+                    break;
+                }
                 strcat(tk_subseq, temp_subseq);
                 free(temp_subseq);
             }
-            tokenspace = strtok(NULL, " ");
+            tokenspace = strtok_r(NULL, " ", &saveptr);
         }
     }
+    free(tk_loc);
+    if (failed) {
+        free(tk_subseq);
+        tk_subseq = NULL;
+    }
     return tk_subseq;
 }
 
 
-void extract_annotation(int *cds_count, int *rna_count, int *trn_count, Cds **cds_list, Faa **faa, Pep **pep_list, Rrn **rrna_list, Trn **trna_list, char *genbank_file) {
-
-    FILE *gbk = fopen(genbank_file, "r");
-    if (!gbk) {
-        log_print(ERROR, "Failed to open genbank file '%s'", genbank_file);
-        exit(EXIT_FAILURE);
-    }
+void free_annotation(int cds_count, int rrn_count, int trn_count, Cds *cds_list, Faa *faa, Pep *pep_list, Rrn *rrn_list, Trn *trn_list, char *organism, char *accession);
 
+// Parse a genbank record from an open stream, which is closed when done.
+// Returns -1, with nothing left allocated, when the record is malformed or memory runs out
+int read_annotation(int *cds_count, int *rna_count, int *trn_count, Cds **cds_list, Faa **faa, Pep **pep_list, Rrn **rrna_list, Trn **trna_list, char **organism, char **accession, FILE *gbk) {
 
     char line[MAX_LINE_LEN];
 
-    *pep_list = malloc(sizeof(Pep) * 100);
-    *cds_list = malloc(sizeof(Cds) * 100);
-    *rrna_list = malloc(sizeof(Rrn) * 100);
-    *trna_list = malloc(sizeof(Trn) * 100);
-    if (*pep_list == NULL) {
-        log_print(ERROR, "Failed to allocate memory for pep_list");
+    *pep_list = calloc(MAX_FEATURE_NUM, sizeof(Pep));
+    *cds_list = calloc(MAX_FEATURE_NUM, sizeof(Cds));
+    *rrna_list = calloc(MAX_FEATURE_NUM, sizeof(Rrn));
+    *trna_list = calloc(MAX_FEATURE_NUM, sizeof(Trn));
+    *faa = calloc(1, sizeof(Faa));
+    if (*pep_list == NULL || *cds_list == NULL || *rrna_list == NULL || *trna_list == NULL || *faa == NULL) {
+        log_print(ERROR, "Failed to allocate memory for annotation lists");
+        free(*pep_list);
+        free(*cds_list);
+        free(*rrna_list);
+        free(*trna_list);
+        free(*faa);
+        *pep_list = NULL;
+        *cds_list = NULL;
+        *rrna_list = NULL;
+        *trna_list = NULL;
+        *faa = NULL;
         fclose(gbk);
-        exit(EXIT_FAILURE);
+        return -1;
     }
-    *faa = malloc(sizeof(Faa));
 
     int cds_flag = 0;
     int pep_flag = 0;
@@ -410,8 +531,7 @@ void extract_annotation(int *cds_count, int *rna_count, int *trn_count, Cds **cd
             if (organ == NULL)
             {
                 log_print(ERROR, "Failed to allocate memory for organism name");
-                fclose(gbk);
-                exit(EXIT_FAILURE);
+                goto fail;
             }
             strcpy(organ, line + 12);
             size_t len = strlen(organ);
@@ -425,8 +545,7 @@ void extract_annotation(int *cds_count, int *rna_count, int *trn_count, Cds **cd
             if (acces == NULL)
             {
                 log_print(ERROR, "Failed to allocate memory for accession");
-                fclose(gbk);
-                exit(EXIT_FAILURE);
+                goto fail;
             }
             strcpy(acces, line + 12);
             size_t len = strlen(acces);
@@ -448,14 +567,13 @@ void extract_annotation(int *cds_count, int *rna_count, int *trn_count, Cds **cd
             memset((*faa)->sequence, 0, 1);
             faa_flag = 1;
         } else if (faa_flag == 1) {
-            sscanf(line, "        %*d %s %s %s %s %s %s", seq1, seq2, seq3, seq4, seq5, seq6);
+            sscanf(line, "        %*d %59s %59s %59s %59s %59s %59s", seq1, seq2, seq3, seq4, seq5, seq6);
             sprintf(temp_faa, "%s%s%s%s%s%s", seq1, seq2, seq3, seq4, seq5, seq6);
             (*faa)->sequence = realloc((*faa)->sequence, strlen((*faa)->sequence) + strlen(temp_faa) + 1);
             if ((*faa)->sequence == NULL)
             {
                 log_print(ERROR, "Failed to allocate memory for faa sequence");
-                fclose(gbk);
-                exit(EXIT_FAILURE);
+                goto fail;
             }
 
             int i = 0;
@@ -470,8 +588,7 @@ void extract_annotation(int *cds_count, int *rna_count, int *trn_count, Cds **cd
     }
     if ((*faa)->sequence == NULL || faa_flag != 1) {
         log_print(ERROR, "gb file format error or incomplete sequence.");
-        fclose(gbk);
-        exit(EXIT_FAILURE);
+        goto fail;
     }
 
     if (organ != NULL) {
@@ -489,16 +606,19 @@ void extract_annotation(int *cds_count, int *rna_count, int *trn_count, Cds **cd
     while (fgets(line, MAX_LINE_LEN, gbk)) {
 
         if (strstr(line, "     CDS             ")) {
+            if (*cds_count == MAX_FEATURE_NUM) {
+                log_print(ERROR, "More than %d CDS features", MAX_FEATURE_NUM);
+                goto fail;
+            }
             cds_flag = 1;
-            sscanf(line, "     CDS             %s", temp_loc);
+            sscanf(line, "     CDS             %99s", temp_loc);
             if (line[strlen(line) - 2] == ',') {
                 cds_loc_flag = 1;
                 (*cds_list)[*cds_count].location = malloc(strlen(temp_loc) + 1);
                 if ((*cds_list)[*cds_count].location == NULL)
                 {
                     log_print(ERROR, "Failed to allocate memory for cds location");
-                    fclose(gbk);
-                    exit(EXIT_FAILURE);
+                    goto fail;
                 }                
                 strcpy((*cds_list)[*cds_count].location, temp_loc);
             } else {
@@ -508,24 +628,20 @@ void extract_annotation(int *cds_count, int *rna_count, int *trn_count, Cds **cd
                 if ((*cds_list)[*cds_count].location == NULL)
                 {
                     log_print(ERROR, "Failed to allocate memory for cds location");
-                    fclose(gbk);
-                    exit(EXIT_FAILURE);
+                    goto fail;
                 }                
                 strcpy((*cds_list)[*cds_count].location, temp_loc);
-                char *tk_seq = extract_sequence((*faa)->sequence, (*cds_list)[*cds_count].location);
-                (*cds_list)[*cds_count].sequence = malloc(strlen(tk_seq) + 1);
-                strcpy((*cds_list)[*cds_count].sequence, tk_seq);
+                (*cds_list)[*cds_count].sequence = extract_sequence((*faa)->sequence, (*cds_list)[*cds_count].location);
 
             }
         } else if (cds_loc_flag == 1 && cds_flag == 1) {
-            sscanf(line, "                     %s", temp_loc);
+            sscanf(line, "                     %99s", temp_loc);
             if (line[strlen(line) - 2] == ',') {
                 (*cds_list)[*cds_count].location = realloc((*cds_list)[*cds_count].location, strlen((*cds_list)[*cds_count].location) + strlen(temp_loc) + 1);
                 if ((*cds_list)[*cds_count].location == NULL)
                 {
                     log_print(ERROR, "Failed to reallocate memory for cds location");
-                    fclose(gbk);
-                    exit(EXIT_FAILURE);
+                    goto fail;
                 }
                 strcat((*cds_list)[*cds_count].location, temp_loc);
             } else {
@@ -534,18 +650,15 @@ void extract_annotation(int *cds_count, int *rna_count, int *trn_count, Cds **cd
                 if ((*cds_list)[*cds_count].location == NULL)
                 {
                     log_print(ERROR, "Failed to reallocate memory for cds location");
-                    fclose(gbk);
-                    exit(EXIT_FAILURE);
+                    goto fail;
                 }
                 strcat((*cds_list)[*cds_count].location, temp_loc);
-                char *tk_seq = extract_sequence((*faa)->sequence, (*cds_list)[*cds_count].location);
-                (*cds_list)[*cds_count].sequence = malloc(strlen(tk_seq) + 1);
-                strcpy((*cds_list)[*cds_count].sequence, tk_seq);
+                (*cds_list)[*cds_count].sequence = extract_sequence((*faa)->sequence, (*cds_list)[*cds_count].location);
             }
         } else if (cds_flag == 1 && strstr(line, "/gene="))
         {
             // gene_id = (char *)malloc(MAX_GENE_LEN);
-            sscanf(line, "                     /gene=\"%[^\"]", gene_id);
+            sscanf(line, "                     /gene=\"%99[^\"]", gene_id);
             (*pep_list)[*cds_count].gene = malloc(strlen(gene_id) + 1);
             (*cds_list)[*cds_count].gene = malloc(strlen(gene_id) + 1);
             
@@ -553,12 +666,14 @@ void extract_annotation(int *cds_count, int *rna_count, int *trn_count, Cds **cd
             if ((*pep_list)[*cds_count].gene == NULL) 
             {
                 log_print(ERROR, "Failed to reallocate memory for pep_list gene");
-                fclose(gbk);
-                exit(EXIT_FAILURE);
+                goto fail;
             }
             strcpy((*pep_list)[*cds_count].gene, gene_id);
             strcpy((*cds_list)[*cds_count].gene, gene_id);
 
+        } else if (cds_flag == 1 && strstr(line, "/transl_table="))
+        {
+            sscanf(strstr(line, "/transl_table=") + 14, "%d", &(*cds_list)[*cds_count].transl_table);
         } else if (cds_flag == 1 && strstr(line, "/translation"))
         {
             if (line[strlen(line) - 2] == '\"')
@@ -576,8 +691,7 @@ void extract_annotation(int *cds_count, int *rna_count, int *trn_count, Cds **cd
                 if ((*pep_list)[*cds_count].sequence == NULL)
                 {
                     log_print(ERROR, "Failed to reallocate memory for pep_list sequence");
-                    fclose(gbk);
-                    exit(EXIT_FAILURE);
+                    goto fail;
                 }
 
                 strcpy((*pep_list)[*cds_count].sequence, temp_seq);
@@ -598,8 +712,7 @@ void extract_annotation(int *cds_count, int *rna_count, int *trn_count, Cds **cd
                 if ((*pep_list)[*cds_count].sequence == NULL)
                 {
                     log_print(ERROR, "Failed to reallocate memory for pep_list sequence");
-                    fclose(gbk);
-                    exit(EXIT_FAILURE);
+                    goto fail;
                 }                
                 strcpy((*pep_list)[*cds_count].sequence, temp_seq);
             }
@@ -619,8 +732,7 @@ void extract_annotation(int *cds_count, int *rna_count, int *trn_count, Cds **cd
                 if ((*pep_list)[*cds_count].sequence == NULL)
                 {
                     log_print(ERROR, "Failed to reallocate memory for pep_list sequence");
-                    fclose(gbk);
-                    exit(EXIT_FAILURE);
+                    goto fail;
                 }
                 strcat((*pep_list)[*cds_count].sequence, temp_seq);
                 (*cds_count)++;
@@ -637,22 +749,24 @@ void extract_annotation(int *cds_count, int *rna_count, int *trn_count, Cds **cd
                 if ((*pep_list)[*cds_count].sequence == NULL)
                 {
                     log_print(ERROR, "Failed to reallocate memory for pep_list sequence");
-                    fclose(gbk);
-                    exit(EXIT_FAILURE);
+                    goto fail;
                 }
                 strcat((*pep_list)[*cds_count].sequence, temp_seq);
             }
         } else if (strstr(line, "     rRNA            ")) {
+            if (*rna_count == MAX_FEATURE_NUM) {
+                log_print(ERROR, "More than %d rRNA features", MAX_FEATURE_NUM);
+                goto fail;
+            }
             rrn_flag = 1;
-            sscanf(line, "     rRNA             %s", temp_loc);
+            sscanf(line, "     rRNA             %99s", temp_loc);
             if (line[strlen(line) - 2] == ',') {
                 rrn_loc_flag = 1;
                 (*rrna_list)[*rna_count].location = malloc(strlen(temp_loc) + 1);
                 if ((*rrna_list)[*rna_count].location == NULL)
                 {
                     log_print(ERROR, "Failed to allocate memory for rRNA location");
-                    fclose(gbk);
-                    exit(EXIT_FAILURE);
+                    goto fail;
                 }                
                 strcpy((*rrna_list)[*rna_count].location, temp_loc);
             } else {
@@ -662,24 +776,20 @@ void extract_annotation(int *cds_count, int *rna_count, int *trn_count, Cds **cd
                 if ((*rrna_list)[*rna_count].location == NULL)
                 {
                     log_print(ERROR, "Failed to allocate memory for rRNA location");
-                    fclose(gbk);
-                    exit(EXIT_FAILURE);
+                    goto fail;
                 }                
                 strcpy((*rrna_list)[*rna_count].location, temp_loc);
-                char *tk_seq = extract_sequence((*faa)->sequence, (*rrna_list)[*rna_count].location);
-                (*rrna_list)[*rna_count].sequence = malloc(strlen(tk_seq) + 1);
-                strcpy((*rrna_list)[*rna_count].sequence, tk_seq);
+                (*rrna_list)[*rna_count].sequence = extract_sequence((*faa)->sequence, (*rrna_list)[*rna_count].location);
 
             }
         } else if (rrn_loc_flag == 1 && rrn_flag == 1) {
-            sscanf(line, "                     %s", temp_loc);
+            sscanf(line, "                     %99s", temp_loc);
             if (line[strlen(line) - 2] == ',') {
                 (*rrna_list)[*rna_count].location = realloc((*rrna_list)[*rna_count].location, strlen((*rrna_list)[*rna_count].location) + strlen(temp_loc) + 1);
                 if ((*rrna_list)[*rna_count].location == NULL)
                 {
                     log_print(ERROR, "Failed to reallocate memory for rRNA location");
-                    fclose(gbk);
-                    exit(EXIT_FAILURE);
+                    goto fail;
                 }
                 strcat((*rrna_list)[*rna_count].location, temp_loc);
             } else {
@@ -688,41 +798,40 @@ void extract_annotation(int *cds_count, int *rna_count, int *trn_count, Cds **cd
                 if ((*rrna_list)[*rna_count].location == NULL)
                 {
                     log_print(ERROR, "Failed to reallocate memory for rRNA location");
-                    fclose(gbk);
-                    exit(EXIT_FAILURE);
+                    goto fail;
                 }
                 strcat((*rrna_list)[*rna_count].location, temp_loc);
-                char *tk_seq = extract_sequence((*faa)->sequence, (*rrna_list)[*rna_count].location);
-                (*rrna_list)[*rna_count].sequence = malloc(strlen(tk_seq) + 1);
-                strcpy((*rrna_list)[*rna_count].sequence, tk_seq);
+                (*rrna_list)[*rna_count].sequence = extract_sequence((*faa)->sequence, (*rrna_list)[*rna_count].location);
             }
         } else if (rrn_flag == 1 && strstr(line, "/gene=")) {
             // gene_id = (char *)malloc(MAX_GENE_LEN);
-            sscanf(line, "                     /gene=\"%[^\"]", gene_id);
+            sscanf(line, "                     /gene=\"%99[^\"]", gene_id);
 
             (*rrna_list)[*rna_count].gene = malloc(strlen(gene_id) + 1);
             
             if ((*rrna_list)[*rna_count].gene == NULL) 
             {
                 log_print(ERROR, "Failed to reallocate memory for pep_list gene");
-                fclose(gbk);
-                exit(EXIT_FAILURE);
+                goto fail;
             }
             strcpy((*rrna_list)[*rna_count].gene, gene_id);
 
             (*rna_count)++;
             rrn_flag = 0;
         } else if (strstr(line, "     tRNA            ")) {
+            if (*trn_count == MAX_FEATURE_NUM) {
+                log_print(ERROR, "More than %d tRNA features", MAX_FEATURE_NUM);
+                goto fail;
+            }
             trn_flag = 1;
-            sscanf(line, "     tRNA             %s", temp_loc);
+            sscanf(line, "     tRNA             %99s", temp_loc);
             if (line[strlen(line) - 2] == ',') {
                 trn_loc_flag = 1;
                 (*trna_list)[*trn_count].location = malloc(strlen(temp_loc) + 1);
                 if ((*trna_list)[*trn_count].location == NULL)
                 {
                     log_print(ERROR, "Failed to allocate memory for tRNA location");
-                    fclose(gbk);
-                    exit(EXIT_FAILURE);
+                    goto fail;
                 }                
                 strcpy((*trna_list)[*trn_count].location, temp_loc);
             } else {
@@ -732,24 +841,20 @@ void extract_annotation(int *cds_count, int *rna_count, int *trn_count, Cds **cd
                 if ((*trna_list)[*trn_count].location == NULL)
                 {
                     log_print(ERROR, "Failed to allocate memory for tRNA location");
-                    fclose(gbk);
-                    exit(EXIT_FAILURE);
+                    goto fail;
                 }                
                 strcpy((*trna_list)[*trn_count].location, temp_loc);
-                char *tk_seq = extract_sequence((*faa)->sequence, (*trna_list)[*trn_count].location);
-                (*trna_list)[*trn_count].sequence = malloc(strlen(tk_seq) + 1);
-                strcpy((*trna_list)[*trn_count].sequence, tk_seq);
+                (*trna_list)[*trn_count].sequence = extract_sequence((*faa)->sequence, (*trna_list)[*trn_count].location);
 
             }
         } else if (trn_loc_flag == 1 && trn_flag == 1) {
-            sscanf(line, "                     %s", temp_loc);
+            sscanf(line, "                     %99s", temp_loc);
             if (line[strlen(line) - 2] == ',') {
                 (*trna_list)[*trn_count].location = realloc((*trna_list)[*trn_count].location, strlen((*trna_list)[*trn_count].location) + strlen(temp_loc) + 1);
                 if ((*trna_list)[*trn_count].location == NULL)
                 {
                     log_print(ERROR, "Failed to reallocate memory for tRNA location");
-                    fclose(gbk);
-                    exit(EXIT_FAILURE);
+                    goto fail;
                 }
                 strcat((*trna_list)[*trn_count].location, temp_loc);
             } else {
@@ -758,24 +863,20 @@ void extract_annotation(int *cds_count, int *rna_count, int *trn_count, Cds **cd
                 if ((*trna_list)[*trn_count].location == NULL)
                 {
                     log_print(ERROR, "Failed to reallocate memory for tRNA location");
-                    fclose(gbk);
-                    exit(EXIT_FAILURE);
+                    goto fail;
                 }
                 strcat((*trna_list)[*trn_count].location, temp_loc);
-                char *tk_seq = extract_sequence((*faa)->sequence, (*trna_list)[*trn_count].location);
-                (*trna_list)[*trn_count].sequence = malloc(strlen(tk_seq) + 1);
-                strcpy((*trna_list)[*trn_count].sequence, tk_seq);
+                (*trna_list)[*trn_count].sequence = extract_sequence((*faa)->sequence, (*trna_list)[*trn_count].location);
             }
         } else if (trn_flag == 1 && strstr(line, "/gene=")) {
             // gene_id = (char *)malloc(MAX_GENE_LEN);
-            sscanf(line, "                     /gene=\"%[^\"]", gene_id);
+            sscanf(line, "                     /gene=\"%99[^\"]", gene_id);
             (*trna_list)[*trn_count].gene = malloc(strlen(gene_id) + 1);
             
             if ((*trna_list)[*trn_count].gene == NULL) 
             {
                 log_print(ERROR, "Failed to reallocate memory for pep_list gene");
-                fclose(gbk);
-                exit(EXIT_FAILURE);
+                goto fail;
             }
             strcpy((*trna_list)[*trn_count].gene, gene_id);
             (*trn_count)++;
@@ -783,146 +884,3033 @@ void extract_annotation(int *cds_count, int *rna_count, int *trn_count, Cds **cd
         }
     }
     fclose(gbk);
-    free(organ);
-    free(acces);
+    *organism = organ;
+    *accession = acces;
+    return 0;
+
+fail:
+    // entries past the counts may be half filled, the lists are zeroed so free them all
+    fclose(gbk);
+    free_annotation(MAX_FEATURE_NUM, MAX_FEATURE_NUM, MAX_FEATURE_NUM, *cds_list, *faa, *pep_list, *rrna_list, *trna_list, organ, acces);
+    *cds_count = *rna_count = *trn_count = 0;
+    *cds_list = NULL;
+    *faa = NULL;
+    *pep_list = NULL;
+    *rrna_list = NULL;
+    *trna_list = NULL;
+    *organism = NULL;
+    *accession = NULL;
+    return -1;
 }
 
 
+// Parse a genbank file; returns -1 when it cannot be opened or read_annotation() fails
+int extract_annotation(int *cds_count, int *rna_count, int *trn_count, Cds **cds_list, Faa **faa, Pep **pep_list, Rrn **rrna_list, Trn **trna_list, char **organism, char **accession, char *genbank_file) {
+    FILE *gbk = fopen(genbank_file, "r");
+    if (!gbk) {
+        log_print(ERROR, "Failed to open genbank file '%s'", genbank_file);
+        return -1;
+    }
+    return read_annotation(cds_count, rna_count, trn_count, cds_list, faa, pep_list, rrna_list, trna_list, organism, accession, gbk);
+}
 
-int main(int argc, char *argv[]) {
 
-    char *genbank_file = malloc(1024);
-    char *prefix = malloc(1024);
-    int all_flag = 0;
-    int faa_flag = 0;
-    int pep_flag = 0;
-    int cds_flag = 0;
-    int trn_flag = 0;
-    int rrn_flag = 0;
-    char *output_file = malloc(1024);
-    
-    parse_arguments(argc, argv, genbank_file, prefix, &all_flag, &faa_flag, &pep_flag, &cds_flag, &trn_flag, &rrn_flag, output_file);
+// One GFF3 feature, CDS/tRNA/rRNA lines sharing an ID (or Parent) are its segments
+typedef struct {
+    char type;
+    char strand;
+    char *key;
+    char *name;
+    char *parent;
+    char *seqid;
+    int seg_count;
+    int seg_capacity;
+    int *starts;
+    int *ends;
+    int transl_table;
+} GffFeature;
+
+// One record of the genome fasta
+typedef struct {
+    char *name;
+    char *description;
+    char *sequence;
+} FastaRecord;
+
+
+// Return a copy of the value of "key=" in a GFF3 attribute column, NULL if absent
+char* gff_attribute(const char *attrs, const char *key) {
+    size_t key_len = strlen(key);
+    const char *p = attrs;
+    while (p != NULL && *p != '\0') {
+        if (strncmp(p, key, key_len) == 0 && p[key_len] == '=') {
+            p += key_len + 1;
+            size_t len = strcspn(p, ";,\t\r\n");
+            char *value = malloc(len + 1);
+            memcpy(value, p, len);
+            value[len] = '\0';
+            return value;
+        }
+        p = strchr(p, ';');
+        if (p != NULL) {
+            p++;
+            while (*p == ' ') p++;
+        }
+    }
+    return NULL;
+}
 
-    if (access(genbank_file, F_OK) == -1) {
-        log_print(ERROR, "%s does not exist (gb).", genbank_file);
-        free(genbank_file);
-        free(prefix);
-        free(output_file);
-        exit(1);
+
+void free_fasta_records(FastaRecord *records, int record_count) {
+    for (int i = 0; i < record_count; i++) {
+        free(records[i].name);
+        free(records[i].description);
+        free(records[i].sequence);
     }
-    log_print(INFO, "The genbank file: %s", genbank_file);
-    log_print(INFO, "The prefix: %s", prefix);
-    log_print(INFO, "The output path: %s", output_file);
+    free(records);
+}
 
-    if (access(output_file, F_OK) == -1) {
-        log_print(ERROR, "Output Path does not exist.");
-        exit(1);
+
+// Parse the fasta held in [data, data + len) into records, sequences upper-cased and unwrapped.
+// Returns NULL with *record_count = -1 when memory runs out
+FastaRecord* parse_fasta_records(const char *data, size_t len, int *record_count) {
+    int capacity = 4;
+    FastaRecord *records = malloc(sizeof(FastaRecord) * capacity);
+    size_t seq_len = 0, seq_cap = 0;
+    const char *p = data, *end = data + len;
+    *record_count = 0;
+    if (records == NULL) {
+        log_print(ERROR, "Failed to allocate memory for fasta records");
+        *record_count = -1;
+        return NULL;
     }
-    
 
-    // Define arrays to store annotations
-    Cds *cds_list = NULL;
-    Faa *faa = NULL;
-    Pep *pep_list = NULL;
-    Rrn *rrn_list = NULL;
-    Trn *trn_list = NULL;
-    int cds_count = 0;
-    int rrn_count = 0;
-    int trn_count = 0;
+    while (p < end) {
+        const char *eol = memchr(p, '\n', end - p);
+        if (eol == NULL) eol = end;
+        if (*p == '>') {
+            if (*record_count == capacity) {
+                FastaRecord *grown = realloc(records, sizeof(FastaRecord) * capacity * 2);
+                if (grown == NULL) {
+                    log_print(ERROR, "Failed to allocate memory for fasta records");
+                    goto fail;
+                }
+                records = grown;
+                capacity *= 2;
+            }
+            FastaRecord *rec = &records[(*record_count)++];
+            const char *name = p + 1;
+            const char *name_end = name;
+            while (name_end < eol && !isspace((unsigned char)*name_end)) name_end++;
+            rec->name = strndup(name, name_end - name);
+            while (name_end < eol && isspace((unsigned char)*name_end)) name_end++;
+            const char *desc_end = eol;
+            while (desc_end > name_end && isspace((unsigned char)desc_end[-1])) desc_end--;
+            rec->description = strndup(name_end, desc_end - name_end);
+            seq_cap = 16384;
+            seq_len = 0;
+            rec->sequence = malloc(seq_cap);
+            if (rec->name == NULL || rec->description == NULL || rec->sequence == NULL) {
+                log_print(ERROR, "Failed to allocate memory for fasta records");
+                goto fail;
+            }
+            rec->sequence[0] = '\0';
+        } else if (*record_count > 0) {
+            FastaRecord *rec = &records[*record_count - 1];
+            if (seq_len + (eol - p) + 1 > seq_cap) {
+                while (seq_len + (eol - p) + 1 > seq_cap) seq_cap *= 2;
+                char *grown = realloc(rec->sequence, seq_cap);
+                if (grown == NULL) {
+                    log_print(ERROR, "Failed to allocate memory for fasta sequence");
+                    goto fail;
+                }
+                rec->sequence = grown;
+            }
+            for (const char *c = p; c < eol; c++) {
+                if (!isspace((unsigned char)*c)) {
+                    rec->sequence[seq_len++] = toupper((unsigned char)*c);
+                }
+            }
+            rec->sequence[seq_len] = '\0';
+        }
+        p = eol + 1;
+    }
+    return records;
+
+fail:
+    free_fasta_records(records, *record_count);
+    *record_count = -1;
+    return NULL;
+}
+
+
+// Map the fasta part of a file (from offset on) and parse it; *record_count is -1 when that fails
+FastaRecord* load_fasta(const char *fasta_file, long offset, int *record_count) {
+    int fd = open(fasta_file, O_RDONLY);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) == -1) {
+        log_print(ERROR, "Failed to open fasta file '%s'", fasta_file);
+        if (fd != -1) close(fd);
+        *record_count = -1;
+        return NULL;
+    }
+    if (st.st_size <= offset) {
+        close(fd);
+        *record_count = 0;
+        return NULL;
+    }
+    char *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        log_print(ERROR, "Failed to map fasta file '%s'", fasta_file);
+        *record_count = -1;
+        return NULL;
+    }
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+    FastaRecord *records = parse_fasta_records(data + offset, st.st_size - offset, record_count);
+    munmap(data, st.st_size);
+    return records;
+}
 
 
+// Genome fasta stored next to a GFF3 file (<base>.fasta, .fa or .fna), NULL if there is none
+char* gff_sibling_fasta(const char *gff_file) {
+    const char *exts[] = {".fasta", ".fa", ".fna"};
+    char *sibling = malloc(strlen(gff_file) + 8);
+    for (int i = 0; i < 3; i++) {
+        strcpy(sibling, gff_file);
+        strcpy(strrchr(sibling, '.'), exts[i]);
+        if (access(sibling, F_OK) == 0) {
+            return sibling;
+        }
+    }
+    free(sibling);
+    return NULL;
+}
 
-    extract_annotation(&cds_count, &rrn_count, &trn_count, &cds_list, &faa, &pep_list, &rrn_list, &trn_list, genbank_file);
 
-    size_t len = strlen(output_file);
-    if (len > 0 && output_file[len - 1] != '/') {
-        strcat(output_file, "/");
+void free_gff_features(GffFeature *features, int feature_count) {
+    for (int i = 0; features != NULL && i < feature_count; i++) {
+        free(features[i].key);
+        free(features[i].name);
+        free(features[i].parent);
+        free(features[i].seqid);
+        free(features[i].starts);
+        free(features[i].ends);
     }
-    // Print the annotations
-    if (cds_flag == 1) {
-        char *output_cds = malloc(1024);
-        strcpy(output_cds, output_file);
-        strcat(output_cds, prefix);
-        strcat(output_cds, ".cds");
-        FILE *fcds = fopen(output_cds, "w");
-        for (int i = 0; i < cds_count; i++)
-        {
-            fprintf(fcds, ">%s\n", cds_list[i].gene);
-            fprintf(fcds, "%s\n", cds_list[i].sequence);
+    free(features);
+}
+
+
+// Build a genbank style location ("complement(join(a..b,c..d))") for extract_sequence()
+char* gff_location(GffFeature *feature) {
+    // segments in ascending order, as genbank lists them
+    for (int i = 1; i < feature->seg_count; i++) {
+        int s = feature->starts[i], e = feature->ends[i], j = i - 1;
+        while (j >= 0 && feature->starts[j] > s) {
+            feature->starts[j + 1] = feature->starts[j];
+            feature->ends[j + 1] = feature->ends[j];
+            j--;
         }
-        fclose(fcds);
-        log_print(INFO, "CDS sequences saved to %s", output_cds);
+        feature->starts[j + 1] = s;
+        feature->ends[j + 1] = e;
     }
 
-    if (rrn_flag == 1) {
-        char *output_rrn = malloc(1024);
-        strcpy(output_rrn, output_file);
-        strcat(output_rrn, prefix);
-        strcat(output_rrn, ".rrn");
-        FILE *frrn = fopen(output_rrn, "w");
-        for (int i = 0; i < rrn_count; i++)
-        {
-            fprintf(frrn, ">%s\n", rrn_list[i].gene);
-            fprintf(frrn, "%s\n", rrn_list[i].sequence);
+    char *location = malloc(feature->seg_count * 24 + 32);
+    char *p = location;
+    if (feature->strand == '-') p += sprintf(p, "complement(");
+    if (feature->seg_count > 1) p += sprintf(p, "join(");
+    for (int i = 0; i < feature->seg_count; i++) {
+        p += sprintf(p, "%s%d..%d", i > 0 ? "," : "", feature->starts[i], feature->ends[i]);
+    }
+    if (feature->seg_count > 1) p += sprintf(p, ")");
+    if (feature->strand == '-') p += sprintf(p, ")");
+    return location;
+}
+
+
+// Read GFF3 annotation (MitoZ/MITOS) into the same feature lists extract_annotation() fills.
+// The genome comes from the embedded ##FASTA section, fasta_file, or <base>.fasta/.fa/.fna next to the GFF3.
+// Returns -1, with nothing left allocated, when the GFF3 or its genome cannot be read
+int extract_gff_annotation(int *cds_count, int *rna_count, int *trn_count, Cds **cds_list, Faa **faa, Pep **pep_list, Rrn **rrna_list, Trn **trna_list, char **organism, char **accession, char *gff_file, char *fasta_file) {
+
+    FILE *gff = fopen(gff_file, "r");
+    if (!gff) {
+        log_print(ERROR, "Failed to open GFF3 file '%s'", gff_file);
+        return -1;
+    }
+
+    *pep_list = calloc(MAX_FEATURE_NUM, sizeof(Pep));
+    *cds_list = calloc(MAX_FEATURE_NUM, sizeof(Cds));
+    *rrna_list = calloc(MAX_FEATURE_NUM, sizeof(Rrn));
+    *trna_list = calloc(MAX_FEATURE_NUM, sizeof(Trn));
+    *faa = calloc(1, sizeof(Faa));
+
+    int feature_count = 0;
+    int feature_capacity = 64;
+    GffFeature *features = calloc(feature_capacity, sizeof(GffFeature));
+    char *organ = NULL;
+    long fasta_offset = -1;
+    int record_count = 0;
+    FastaRecord *records = NULL;
+    if (*pep_list == NULL || *cds_list == NULL || *rrna_list == NULL || *trna_list == NULL || *faa == NULL || features == NULL) {
+        log_print(ERROR, "Failed to allocate memory for annotation lists");
+        fclose(gff);
+        goto fail;
+    }
+
+    char *line = NULL;
+    size_t line_cap = 0;
+    while (getline(&line, &line_cap, gff) != -1) {
+        if (strncmp(line, "##FASTA", 7) == 0) {
+            fasta_offset = ftell(gff);
+            break;
         }
-        fclose(frrn);
-        log_print(INFO, "rRNA sequences saved to %s", output_rrn);
+        if (strncmp(line, "##species ", 10) == 0 && organ == NULL) {
+            organ = strndup(line + 10, strcspn(line + 10, "\r\n"));
+            continue;
+        }
+        if (line[0] == '#' || line[0] == '\n') {
+            continue;
+        }
+
+        char *cols[9];
+        int ncol = 0;
+        char *p = line;
+        while (ncol < 9) {
+            cols[ncol++] = p;
+            p = strchr(p, '\t');
+            if (p == NULL) break;
+            *p++ = '\0';
+        }
+        if (ncol < 9) {
+            continue;
+        }
+
+        char type;
+        if (strcmp(cols[2], "CDS") == 0) type = 'C';
+        else if (strcmp(cols[2], "tRNA") == 0) type = 'T';
+        else if (strcmp(cols[2], "rRNA") == 0) type = 'R';
+        else if (strcmp(cols[2], "gene") == 0) type = 'G';
+        else continue;
+
+        char *id = gff_attribute(cols[8], "ID");
+        char *parent = gff_attribute(cols[8], "Parent");
+        char *name = gff_attribute(cols[8], "Name");
+        if (name == NULL) name = gff_attribute(cols[8], "gene");
+        if (name == NULL) name = gff_attribute(cols[8], "gene_id");
+
+        // segments of a split feature share their ID, or only their Parent
+        const char *key = id ? id : parent;
+        GffFeature *feature = NULL;
+        for (int i = feature_count - 1; key != NULL && i >= 0; i--) {
+            if (features[i].type == type && features[i].key != NULL && strcmp(features[i].key, key) == 0 && strcmp(features[i].seqid, cols[0]) == 0) {
+                feature = &features[i];
+                break;
+            }
+        }
+        if (feature == NULL) {
+            if (feature_count == feature_capacity) {
+                GffFeature *grown = realloc(features, sizeof(GffFeature) * feature_capacity * 2);
+                if (grown == NULL) {
+                    log_print(ERROR, "Failed to allocate memory for GFF3 features");
+                    free(id);
+                    free(parent);
+                    free(name);
+                    free(line);
+                    fclose(gff);
+                    goto fail;
+                }
+                features = grown;
+                feature_capacity *= 2;
+            }
+            feature = &features[feature_count++];
+            memset(feature, 0, sizeof(GffFeature));
+            feature->type = type;
+            feature->strand = cols[6][0];
+            feature->key = key ? strdup(key) : NULL;
+            feature->parent = parent ? strdup(parent) : NULL;
+            feature->name = name ? strdup(name) : (id ? strdup(id) : NULL);
+            feature->seqid = strdup(cols[0]);
+            char *table = gff_attribute(cols[8], "transl_table");
+            feature->transl_table = table ? atoi(table) : 0;
+            free(table);
+        }
+        if (feature->seg_count == feature->seg_capacity) {
+            feature->seg_capacity = feature->seg_capacity ? feature->seg_capacity * 2 : 2;
+            feature->starts = realloc(feature->starts, sizeof(int) * feature->seg_capacity);
+            feature->ends = realloc(feature->ends, sizeof(int) * feature->seg_capacity);
+        }
+        feature->starts[feature->seg_count] = atoi(cols[3]);
+        feature->ends[feature->seg_count] = atoi(cols[4]);
+        feature->seg_count++;
+
+        free(id);
+        free(parent);
+        free(name);
+    }
+    free(line);
+    fclose(gff);
+
+    // genome sequence: embedded ##FASTA, -s/--fasta, or a fasta next to the GFF3
+    if (fasta_offset >= 0) {
+        records = load_fasta(gff_file, fasta_offset, &record_count);
+    } else if (fasta_file != NULL && strlen(fasta_file) > 0) {
+        records = load_fasta(fasta_file, 0, &record_count);
+    } else {
+        char *sibling = gff_sibling_fasta(gff_file);
+        if (sibling != NULL) {
+            records = load_fasta(sibling, 0, &record_count);
+            free(sibling);
+        }
+    }
+    if (record_count == 0) {
+        log_print(ERROR, "No genome sequence for '%s' (no ##FASTA section or fasta file)", gff_file);
+    }
+    if (record_count <= 0) {
+        goto fail;
     }
 
+    *accession = strdup(records[0].name);
+    log_print(INFO, "The accession is: %s", *accession);
+    if (organ == NULL && strlen(records[0].description) > 0) {
+        organ = strdup(records[0].description);
+    }
+    if (organ == NULL) {
+        organ = strdup("Chr1");
+    }
+    log_print(INFO, "The organism is: %s", organ);
 
-    if (trn_flag == 1) {
-        char *output_trn = malloc(1024);
-        strcpy(output_trn, output_file);
-        strcat(output_trn, prefix);
-        strcat(output_trn, ".trn");
-        FILE *ftrn = fopen(output_trn, "w");
-        for (int i = 0; i < trn_count; i++)
-        {
-            fprintf(ftrn, ">%s\n", trn_list[i].gene);
-            fprintf(ftrn, "%s\n", trn_list[i].sequence);
+    (*faa)->sequence = strdup(records[0].sequence);
+    (*faa)->gene = malloc(strlen(organ) + 2);
+    sprintf((*faa)->gene, "%s\n", organ);
+
+    int warned_pep = 0;
+    for (int i = 0; i < feature_count; i++) {
+        GffFeature *feature = &features[i];
+        if (feature->type == 'G') {
+            continue;
+        }
+
+        // CDS/tRNA lines often only carry a Parent, take the name from the gene
+        if (feature->parent != NULL && (feature->name == NULL || (feature->key != NULL && strcmp(feature->name, feature->key) == 0))) {
+            for (int j = 0; j < feature_count; j++) {
+                if (features[j].type == 'G' && features[j].key != NULL && features[j].name != NULL && strcmp(features[j].key, feature->parent) == 0) {
+                    free(feature->name);
+                    feature->name = strdup(features[j].name);
+                    break;
+                }
+            }
+        }
+        if (feature->name == NULL) {
+            feature->name = strdup(feature->parent ? feature->parent : "unknown");
+        }
+
+        char *seq = NULL;
+        for (int j = 0; j < record_count; j++) {
+            if (strcmp(records[j].name, feature->seqid) == 0) {
+                seq = records[j].sequence;
+                break;
+            }
+        }
+        if (seq == NULL) {
+            log_print(WARNING, "Sequence '%s' of feature '%s' not found, skipped", feature->seqid, feature->name);
+            continue;
+        }
+
+        char *location = gff_location(feature);
+        if (feature->type == 'C' && *cds_count < MAX_FEATURE_NUM) {
+            (*cds_list)[*cds_count].gene = strdup(feature->name);
+            (*cds_list)[*cds_count].location = location;
+            (*cds_list)[*cds_count].sequence = extract_sequence(seq, location);
+            (*cds_list)[*cds_count].transl_table = feature->transl_table;
+            // GFF3 carries no /translation
+            (*pep_list)[*cds_count].gene = strdup(feature->name);
+            (*pep_list)[*cds_count].sequence = strdup("");
+            if (!warned_pep) {
+                log_print(WARNING, "GFF3 input has no translations, pep output is left empty");
+                warned_pep = 1;
+            }
+            (*cds_count)++;
+        } else if (feature->type == 'R' && *rna_count < MAX_FEATURE_NUM) {
+            (*rrna_list)[*rna_count].gene = strdup(feature->name);
+            (*rrna_list)[*rna_count].location = location;
+            (*rrna_list)[*rna_count].sequence = extract_sequence(seq, location);
+            (*rna_count)++;
+        } else if (feature->type == 'T' && *trn_count < MAX_FEATURE_NUM) {
+            (*trna_list)[*trn_count].gene = strdup(feature->name);
+            (*trna_list)[*trn_count].location = location;
+            (*trna_list)[*trn_count].sequence = extract_sequence(seq, location);
+            (*trn_count)++;
+        } else {
+            log_print(WARNING, "More than %d features of one type, '%s' skipped", MAX_FEATURE_NUM, feature->name);
+            free(location);
         }
-        fclose(ftrn);
-        log_print(INFO, "tRNA sequences saved to %s", output_trn);
     }
 
-    
-    if (pep_flag == 1) {
-        char *output_pep = malloc(1024);
-        strcpy(output_pep, output_file);
-        strcat(output_pep, prefix);
-        strcat(output_pep, ".pep");
-        FILE *fpep = fopen(output_pep, "w");
-        for (int i = 0; i < cds_count; i++)
-        {
-            fprintf(fpep, ">%s\n", pep_list[i].gene);
-            fprintf(fpep, "%s\n", pep_list[i].sequence);
+    free_gff_features(features, feature_count);
+    free_fasta_records(records, record_count);
+    *organism = organ;
+    return 0;
+
+fail:
+    free_gff_features(features, feature_count);
+    free_annotation(0, 0, 0, *cds_list, *faa, *pep_list, *rrna_list, *trna_list, organ, NULL);
+    *cds_list = NULL;
+    *faa = NULL;
+    *pep_list = NULL;
+    *rrna_list = NULL;
+    *trna_list = NULL;
+    *organism = NULL;
+    *accession = NULL;
+    return -1;
+}
+
+
+// Free everything extract_annotation() allocated for one genome
+void free_annotation(int cds_count, int rrn_count, int trn_count, Cds *cds_list, Faa *faa, Pep *pep_list, Rrn *rrn_list, Trn *trn_list, char *organism, char *accession) {
+    for (int i = 0; i < cds_count; i++) {
+        free(cds_list[i].gene);
+        free(cds_list[i].location);
+        free(cds_list[i].sequence);
+        free(pep_list[i].gene);
+        free(pep_list[i].sequence);
+    }
+    for (int i = 0; i < rrn_count; i++) {
+        free(rrn_list[i].gene);
+        free(rrn_list[i].location);
+        free(rrn_list[i].sequence);
+    }
+    for (int i = 0; i < trn_count; i++) {
+        free(trn_list[i].gene);
+        free(trn_list[i].location);
+        free(trn_list[i].sequence);
+    }
+    if (faa) {
+        free(faa->gene);
+        free(faa->sequence);
+    }
+    free(cds_list);
+    free(faa);
+    free(pep_list);
+    free(rrn_list);
+    free(trn_list);
+    free(organism);
+    free(accession);
+}
+
+
+// Read the batch list: one genbank path per line, blank lines and '#' comments skipped
+char** read_batch_list(const char *batch_file, int *input_count) {
+    FILE *fp = fopen(batch_file, "r");
+    if (!fp) {
+        log_print(ERROR, "Failed to open batch list '%s'", batch_file);
+        exit(EXIT_FAILURE);
+    }
+
+    char line[MAX_LINE_LEN];
+    int capacity = 64;
+    char **inputs = malloc(sizeof(char *) * capacity);
+    *input_count = 0;
+
+    while (fgets(line, MAX_LINE_LEN, fp)) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0' || line[0] == '#') {
+            continue;
         }
-        fclose(fpep);
-        log_print(INFO, "Pep sequences saved to %s", output_pep);
+        if (*input_count == capacity) {
+            capacity *= 2;
+            inputs = realloc(inputs, sizeof(char *) * capacity);
+        }
+        if (inputs == NULL) {
+            log_print(ERROR, "Failed to allocate memory for batch list");
+            fclose(fp);
+            exit(EXIT_FAILURE);
+        }
+        inputs[(*input_count)++] = strdup(line);
     }
+    fclose(fp);
+    return inputs;
+}
 
-    if (faa_flag == 1) {
-        char *output_faa = malloc(1024);
-        strcpy(output_faa, output_file);
-        strcat(output_faa, prefix);
-        strcat(output_faa, ".faa");
-        FILE *ffaa = fopen(output_faa, "w");
-        fprintf(ffaa, ">%s", faa->gene);
-        fprintf(ffaa, "%s\n", faa->sequence);
-        fclose(ffaa);
-        log_print(INFO, "Faa sequences saved to %s", output_faa);
+
+// Derive the output prefix from a genbank path: directory and extension stripped
+void base_name(const char *path, char *prefix) {
+    const char *start = strrchr(path, '/');
+    start = start ? start + 1 : path;
+    strcpy(prefix, start);
+    char *ext = strrchr(prefix, '.');
+    if (ext != NULL && ext != prefix) {
+        *ext = '\0';
     }
+}
 
-    // Clean up memory
-    if (cds_list) free(cds_list);
-    if (faa) free(faa);
-    if (pep_list) free(pep_list);
-    if (rrn_list) free(rrn_list);
-    if (trn_list) free(trn_list);
-    if (genbank_file) free(genbank_file);
-    if (prefix) free(prefix);
-    if (output_file) free(output_file);
-    
+
+// Define a struct to hold the output prefix of one batch input
+typedef struct {
+    char *name;
+    int index;
+    int suffixed;
+} BatchPrefix;
+
+static int compare_batch_prefixes(const void *a, const void *b) {
+    const BatchPrefix *x = a, *y = b;
+    int order = strcmp(x->name, y->name);
+    if (order != 0) return order;
+    if (x->suffixed != y->suffixed) return x->suffixed - y->suffixed;
+    return x->index - y->index;
+}
+
+// Output prefixes of the batch inputs. Inputs with the same base name (e.g. d1/x.gb and d2/x.gb) would
+// overwrite each other's outputs, so all but the first get _<n> appended, n counting inputs from 1.
+// A name taken by an input keeps precedence over the same name made by appending
+char** batch_prefixes(char **inputs, int input_count) {
+    BatchPrefix *sorted = malloc(sizeof(BatchPrefix) * (input_count > 0 ? input_count : 1));
+    char **prefixes = malloc(sizeof(char *) * (input_count > 0 ? input_count : 1));
+    if (sorted == NULL || prefixes == NULL) {
+        log_print(ERROR, "Failed to allocate memory for batch list");
+        exit(EXIT_FAILURE);
+    }
+    for (int n = 0; n < input_count; n++) {
+        sorted[n].name = malloc(strlen(inputs[n]) + 1);
+        base_name(inputs[n], sorted[n].name);
+        sorted[n].index = n;
+        sorted[n].suffixed = 0;
+    }
+
+    // a renamed prefix may itself be taken, so check again until all are distinct
+    int renamed;
+    do {
+        renamed = 0;
+        qsort(sorted, input_count, sizeof(BatchPrefix), compare_batch_prefixes);
+        for (int n = 1; n < input_count; n++) {
+            if (strcmp(sorted[n].name, sorted[n - 1].name) != 0) {
+                continue;
+            }
+            size_t length = strlen(sorted[n].name) + 16;
+            char *name = malloc(length);
+            snprintf(name, length, "%s_%d", sorted[n].name, sorted[n].index + 1);
+            free(sorted[n].name);
+            sorted[n].name = name;
+            sorted[n].suffixed = 1;
+            renamed = 1;
+        }
+    } while (renamed);
+
+    for (int n = 0; n < input_count; n++) {
+        prefixes[sorted[n].index] = sorted[n].name;
+        if (sorted[n].suffixed) {
+            log_print(WARNING, "%s has the same name as another input, its outputs are prefixed %s", inputs[sorted[n].index], sorted[n].name);
+        }
+    }
+    free(sorted);
+    return prefixes;
+}
+
+
+// Gene name synonyms, matched on the lower-cased name without spaces, dashes or underscores
+typedef struct {
+    const char *alias;
+    const char *name;
+} GeneSynonym;
+
+static const GeneSynonym GENE_SYNONYMS[] = {
+    {"cox1", "cox1"}, {"coi", "cox1"}, {"co1", "cox1"}, {"coxi", "cox1"},
+    {"cox2", "cox2"}, {"coii", "cox2"}, {"co2", "cox2"}, {"coxii", "cox2"},
+    {"cox3", "cox3"}, {"coiii", "cox3"}, {"co3", "cox3"}, {"coxiii", "cox3"},
+    {"cob", "cob"}, {"cytb", "cob"}, {"cyb", "cob"},
+    {"atp6", "atp6"}, {"atpase6", "atp6"}, {"atp8", "atp8"}, {"atpase8", "atp8"}, {"atp9", "atp9"},
+    {"nad1", "nad1"}, {"nd1", "nad1"}, {"nadh1", "nad1"},
+    {"nad2", "nad2"}, {"nd2", "nad2"}, {"nadh2", "nad2"},
+    {"nad3", "nad3"}, {"nd3", "nad3"}, {"nadh3", "nad3"},
+    {"nad4", "nad4"}, {"nd4", "nad4"}, {"nadh4", "nad4"},
+    {"nad4l", "nad4l"}, {"nd4l", "nad4l"}, {"nadh4l", "nad4l"},
+    {"nad5", "nad5"}, {"nd5", "nad5"}, {"nadh5", "nad5"},
+    {"nad6", "nad6"}, {"nd6", "nad6"}, {"nadh6", "nad6"},
+    {"rrnl", "rrnL"}, {"rnl", "rrnL"}, {"16s", "rrnL"}, {"16srrna", "rrnL"}, {"16sribosomalrna", "rrnL"}, {"lrrna", "rrnL"},
+    {"rrns", "rrnS"}, {"rns", "rrnS"}, {"12s", "rrnS"}, {"12srrna", "rrnS"}, {"12sribosomalrna", "rrnS"}, {"srrna", "rrnS"},
+};
+
+static const char *AMINO_ACIDS[][2] = {
+    {"ala", "A"}, {"arg", "R"}, {"asn", "N"}, {"asp", "D"}, {"cys", "C"}, {"gln", "Q"}, {"glu", "E"},
+    {"gly", "G"}, {"his", "H"}, {"ile", "I"}, {"leu", "L"}, {"lys", "K"}, {"met", "M"}, {"phe", "F"},
+    {"pro", "P"}, {"ser", "S"}, {"thr", "T"}, {"trp", "W"}, {"tyr", "Y"}, {"val", "V"},
+};
+
+// Map a /gene name onto the name used for the gene-centric output file (COI/COX1/cox1 -> cox1)
+void normalize_gene_name(const char *gene, char *name) {
+    char key[MAX_GENE_LEN] = "";
+    int k = 0;
+    for (int i = 0; gene[i] != '\0' && k < MAX_GENE_LEN - 1; i++) {
+        if (isalnum((unsigned char)gene[i])) {
+            key[k++] = tolower((unsigned char)gene[i]);
+        }
+    }
+    key[k] = '\0';
+
+    for (size_t i = 0; i < sizeof(GENE_SYNONYMS) / sizeof(GENE_SYNONYMS[0]); i++) {
+        if (strcmp(key, GENE_SYNONYMS[i].alias) == 0) {
+            strcpy(name, GENE_SYNONYMS[i].name);
+            return;
+        }
+    }
+
+    // tRNA-Leu / trnaleu -> trnL, trnl1 -> trnL1
+    if (strncmp(key, "trna", 4) == 0 && k >= 7) {
+        for (size_t i = 0; i < sizeof(AMINO_ACIDS) / sizeof(AMINO_ACIDS[0]); i++) {
+            if (strncmp(key + 4, AMINO_ACIDS[i][0], 3) == 0) {
+                sprintf(name, "trn%s%s", AMINO_ACIDS[i][1], key + 7);
+                return;
+            }
+        }
+    }
+    if (strncmp(key, "trn", 3) == 0 && k >= 4 && isalpha((unsigned char)key[3]) && (k == 4 || isdigit((unsigned char)key[4]))) {
+        sprintf(name, "trn%c%s", toupper((unsigned char)key[3]), key + 4);
+        return;
+    }
+
+    // unknown genes keep their own name, made safe for use as a file name
+    int j = 0;
+    for (int i = 0; gene[i] != '\0' && j < MAX_GENE_LEN - 1; i++) {
+        name[j++] = (isalnum((unsigned char)gene[i]) || gene[i] == '-' || gene[i] == '.') ? gene[i] : '_';
+    }
+    name[j] = '\0';
+}
+
+
+static unsigned long hash_string(const char *str) {
+    unsigned long hash = 5381;
+    while (*str) {
+        hash = hash * 33 + (unsigned char)*str++;
+    }
+    return hash;
+}
+
+// Sequences are deduplicated per gene file, in one open-addressing hash table. Records only reach it
+// from the thread writing the gene files, so it needs no locking
+uint64_t xxh64(const void *input, size_t len, uint64_t seed);
+
+// Define a struct to hold one unique sequence of a gene file and the genomes carrying it
+typedef struct {
+    uint64_t hash;
+    char *file_name;
+    char *sequence;
+    char *members;
+    size_t members_len;
+    size_t members_cap;
+    int count;
+} Haplotype;
+
+// Define a struct to hold the unique sequences in the order they were first seen, and their slots
+typedef struct {
+    Haplotype *haplotypes;
+    int count;
+    int capacity;
+    int *slots;
+    int slot_count;
+    long added;
+} DedupTable;
+
+DedupTable* dedup_create(void) {
+    DedupTable *table = calloc(1, sizeof(DedupTable));
+    if (table == NULL) {
+        log_print(ERROR, "Failed to allocate memory for deduplication table");
+        exit(EXIT_FAILURE);
+    }
+    return table;
+}
+
+// Upper case, and for nucleotides the lesser of the sequence and its reverse complement
+static char* canonical_sequence(const char *sequence, int nucleotide) {
+    size_t len = strlen(sequence);
+    char *forward = malloc(len + 1);
+    char *reverse = malloc(len + 1);
+    if (forward == NULL || reverse == NULL) {
+        log_print(ERROR, "Failed to allocate memory for deduplication");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < len; i++) {
+        char c = toupper((unsigned char)sequence[i]);
+        forward[i] = c;
+        switch (c) {
+            case 'A': c = 'T'; break;
+            case 'T': c = 'A'; break;
+            case 'C': c = 'G'; break;
+            case 'G': c = 'C'; break;
+        }
+        reverse[len - 1 - i] = c;
+    }
+    forward[len] = reverse[len] = '\0';
+    if (nucleotide && strcmp(reverse, forward) < 0) {
+        free(forward);
+        return reverse;
+    }
+    free(reverse);
+    return forward;
+}
+
+static void add_member(Haplotype *haplotype, const char *header) {
+    size_t len = strcspn(header, " ");
+    if (haplotype->members_len + len + 2 > haplotype->members_cap) {
+        haplotype->members_cap = (haplotype->members_len + len + 2) * 2;
+        haplotype->members = realloc(haplotype->members, haplotype->members_cap);
+        if (haplotype->members == NULL) {
+            log_print(ERROR, "Failed to allocate memory for deduplication");
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (haplotype->count > 0) {
+        haplotype->members[haplotype->members_len++] = ',';
+    }
+    memcpy(haplotype->members + haplotype->members_len, header, len);
+    haplotype->members_len += len;
+    haplotype->members[haplotype->members_len] = '\0';
+    haplotype->count++;
+}
+
+static void grow_slots(DedupTable *table) {
+    int slot_count = table->slot_count == 0 ? 1024 : table->slot_count * 2;
+    int *slots = malloc(sizeof(int) * slot_count);
+    if (slots == NULL) {
+        log_print(ERROR, "Failed to allocate memory for deduplication table");
+        exit(EXIT_FAILURE);
+    }
+    memset(slots, -1, sizeof(int) * slot_count);
+    for (int i = 0; i < table->count; i++) {
+        unsigned long h = table->haplotypes[i].hash & (slot_count - 1);
+        while (slots[h] != -1) {
+            h = (h + 1) & (slot_count - 1);
+        }
+        slots[h] = i;
+    }
+    free(table->slots);
+    table->slots = slots;
+    table->slot_count = slot_count;
+}
+
+// Record a genome's sequence for a gene file, returns 1 when it is the first copy and must be written
+int dedup_add(DedupTable *table, const char *file_name, const char *sequence, const char *header) {
+    int nucleotide = strstr(file_name, ".pep.") == NULL;
+    char *canonical = canonical_sequence(sequence, nucleotide);
+    uint64_t hash = xxh64(canonical, strlen(canonical), hash_string(file_name));
+
+    table->added++;
+    if (table->count * 2 >= table->slot_count) {
+        grow_slots(table);
+    }
+    unsigned long mask = table->slot_count - 1;
+    unsigned long h = hash & mask;
+    while (table->slots[h] != -1) {
+        Haplotype *haplotype = &table->haplotypes[table->slots[h]];
+        if (haplotype->hash == hash && strcmp(haplotype->file_name, file_name) == 0 && strcmp(haplotype->sequence, canonical) == 0) {
+            add_member(haplotype, header);
+            free(canonical);
+            return 0;
+        }
+        h = (h + 1) & mask;
+    }
+
+    if (table->count == table->capacity) {
+        table->capacity = table->capacity == 0 ? 256 : table->capacity * 2;
+        table->haplotypes = realloc(table->haplotypes, sizeof(Haplotype) * table->capacity);
+        if (table->haplotypes == NULL) {
+            log_print(ERROR, "Failed to allocate memory for deduplication table");
+            exit(EXIT_FAILURE);
+        }
+    }
+    Haplotype *haplotype = &table->haplotypes[table->count];
+    memset(haplotype, 0, sizeof(Haplotype));
+    haplotype->hash = hash;
+    haplotype->file_name = strdup(file_name);
+    haplotype->sequence = canonical;
+    add_member(haplotype, header);
+    table->slots[h] = table->count++;
+    return 1;
+}
+
+// Write <output>/dedup_members.tsv, one line per unique sequence in the order they were first seen
+void dedup_write(DedupTable *table, const char *output_path) {
+    char path[2048];
+    sprintf(path, "%sdedup_members.tsv", output_path);
+    FILE *fp = fopen(path, "w");
+    if (fp == NULL) {
+        log_print(ERROR, "Failed to open output file '%s'", path);
+        exit(EXIT_FAILURE);
+    }
+    fprintf(fp, "File\tRepresentative\tCount\tMembers\n");
+    for (int i = 0; i < table->count; i++) {
+        Haplotype *haplotype = &table->haplotypes[i];
+        fprintf(fp, "%s\t%.*s\t%d\t%s\n", haplotype->file_name, (int)strcspn(haplotype->members, ","), haplotype->members, haplotype->count, haplotype->members);
+    }
+    fclose(fp);
+    log_print(INFO, "%d unique of %ld sequences written, members in %s", table->count, table->added, path);
+}
+
+void dedup_free(DedupTable *table) {
+    for (int i = 0; i < table->count; i++) {
+        free(table->haplotypes[i].file_name);
+        free(table->haplotypes[i].sequence);
+        free(table->haplotypes[i].members);
+    }
+    free(table->haplotypes);
+    free(table->slots);
+    free(table);
+}
+
+
+// One gene-centric output file: records are buffered and appended when the buffer fills
+typedef struct {
+    char *path;
+    char *buffer;
+    size_t len;
+    FILE *fp;
+    int created;
+    unsigned long last_use;
+} GeneFile;
+
+// Bounded pool of gene files, at most max_open handles are open at any time
+typedef struct {
+    GeneFile *files;
+    int count;
+    int capacity;
+    int *slots;
+    int slot_count;
+    int open_count;
+    int max_open;
+    unsigned long tick;
+    char *output_path;
+    FILE *record;
+    DedupTable *dedup;
+} GenePool;
+
+GenePool* gene_pool_create(const char *output_path, int max_open) {
+    GenePool *pool = calloc(1, sizeof(GenePool));
+    pool->capacity = 64;
+    pool->files = calloc(pool->capacity, sizeof(GeneFile));
+    pool->slot_count = 256;
+    pool->slots = malloc(sizeof(int) * pool->slot_count);
+    memset(pool->slots, -1, sizeof(int) * pool->slot_count);
+    pool->max_open = max_open;
+    pool->output_path = strdup(output_path);
+    if (pool->files == NULL || pool->slots == NULL || pool->output_path == NULL) {
+        log_print(ERROR, "Failed to allocate memory for gene output pool");
+        exit(EXIT_FAILURE);
+    }
+    return pool;
+}
+
+// Find the slot holding file_name, or the empty slot where it belongs
+static int *gene_pool_slot(GenePool *pool, const char *file_name) {
+    unsigned long mask = pool->slot_count - 1;
+    unsigned long h = hash_string(file_name) & mask;
+    const char *base;
+    while (pool->slots[h] != -1) {
+        base = strrchr(pool->files[pool->slots[h]].path, '/') + 1;
+        if (strcmp(base, file_name) == 0) {
+            break;
+        }
+        h = (h + 1) & mask;
+    }
+    return &pool->slots[h];
+}
+
+static GeneFile* gene_pool_get(GenePool *pool, const char *file_name) {
+    int *slot = gene_pool_slot(pool, file_name);
+    if (*slot != -1) {
+        return &pool->files[*slot];
+    }
+
+    if (pool->count == pool->capacity) {
+        pool->capacity *= 2;
+        pool->files = realloc(pool->files, sizeof(GeneFile) * pool->capacity);
+        if (pool->files == NULL) {
+            log_print(ERROR, "Failed to allocate memory for gene output pool");
+            exit(EXIT_FAILURE);
+        }
+    }
+    GeneFile *gf = &pool->files[pool->count];
+    memset(gf, 0, sizeof(GeneFile));
+    gf->path = malloc(strlen(pool->output_path) + strlen(file_name) + 1);
+    gf->buffer = malloc(GENE_BUFFER_LEN);
+    if (gf->path == NULL || gf->buffer == NULL) {
+        log_print(ERROR, "Failed to allocate memory for gene output file");
+        exit(EXIT_FAILURE);
+    }
+    sprintf(gf->path, "%s%s", pool->output_path, file_name);
+    *slot = pool->count++;
+
+    // keep the table at most half full
+    if (pool->count * 2 > pool->slot_count) {
+        pool->slot_count *= 2;
+        pool->slots = realloc(pool->slots, sizeof(int) * pool->slot_count);
+        if (pool->slots == NULL) {
+            log_print(ERROR, "Failed to allocate memory for gene output pool");
+            exit(EXIT_FAILURE);
+        }
+        memset(pool->slots, -1, sizeof(int) * pool->slot_count);
+        for (int i = 0; i < pool->count; i++) {
+            *gene_pool_slot(pool, strrchr(pool->files[i].path, '/') + 1) = i;
+        }
+        gf = &pool->files[pool->count - 1];
+    }
+    return gf;
+}
+
+// Write out a file's buffer, closing the least recently used handle if the pool is full
+static void gene_pool_flush(GenePool *pool, GeneFile *gf) {
+    if (gf->len == 0) {
+        return;
+    }
+    if (gf->fp == NULL) {
+        if (pool->open_count >= pool->max_open) {
+            GeneFile *lru = NULL;
+            for (int i = 0; i < pool->count; i++) {
+                if (pool->files[i].fp != NULL && (lru == NULL || pool->files[i].last_use < lru->last_use)) {
+                    lru = &pool->files[i];
+                }
+            }
+            fclose(lru->fp);
+            lru->fp = NULL;
+            pool->open_count--;
+        }
+        gf->fp = fopen(gf->path, gf->created ? "a" : "w");
+        if (gf->fp == NULL) {
+            log_print(ERROR, "Failed to open output file '%s'", gf->path);
+            exit(EXIT_FAILURE);
+        }
+        gf->created = 1;
+        pool->open_count++;
+    }
+    gf->last_use = ++pool->tick;
+    fwrite(gf->buffer, 1, gf->len, gf->fp);
+    gf->len = 0;
+}
+
+void gene_pool_append(GenePool *pool, const char *file_name, const char *header, const char *sequence) {
+    if (pool->record != NULL) {
+        fprintf(pool->record, "%s\t%s\t%s\n", file_name, header, sequence);
+    }
+    if (pool->dedup != NULL && !dedup_add(pool->dedup, file_name, sequence, header)) {
+        return;
+    }
+    GeneFile *gf = gene_pool_get(pool, file_name);
+    size_t header_len = strlen(header);
+    size_t seq_len = strlen(sequence);
+    size_t need = header_len + seq_len + 3;
+
+    if (gf->len + need > GENE_BUFFER_LEN) {
+        gene_pool_flush(pool, gf);
+    }
+    if (need > GENE_BUFFER_LEN) {
+        // larger than a whole buffer, e.g. a plant genome: write it straight through
+        gene_pool_flush(pool, gf);
+        gf->len = sprintf(gf->buffer, ">%s\n", header);
+        gene_pool_flush(pool, gf);
+        fwrite(sequence, 1, seq_len, gf->fp);
+        fputc('\n', gf->fp);
+        return;
+    }
+    gf->len += sprintf(gf->buffer + gf->len, ">%s\n%s\n", header, sequence);
+}
+
+void gene_pool_close(GenePool *pool) {
+    for (int i = 0; i < pool->count; i++) {
+        gene_pool_flush(pool, &pool->files[i]);
+        if (pool->files[i].fp != NULL) {
+            fclose(pool->files[i].fp);
+            pool->files[i].fp = NULL;
+            pool->open_count--;
+        }
+        free(pool->files[i].path);
+        free(pool->files[i].buffer);
+    }
+    log_print(INFO, "%d gene files saved to %s", pool->count, pool->output_path);
+    if (pool->dedup != NULL) {
+        dedup_write(pool->dedup, pool->output_path);
+        dedup_free(pool->dedup);
+    }
+    free(pool->files);
+    free(pool->slots);
+    free(pool->output_path);
+    free(pool);
+}
+
+
+// XXH64 content hash, used to recognise unchanged inputs between runs
+#define XXH_PRIME64_1 0x9E3779B185EBCA87ULL
+#define XXH_PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define XXH_PRIME64_3 0x165667B19E3779F9ULL
+#define XXH_PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define XXH_PRIME64_5 0x27D4EB2F165667C5ULL
+
+static uint64_t xxh_rotl(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static uint64_t xxh_read64(const unsigned char *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint32_t xxh_read32(const unsigned char *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint64_t xxh64_round(uint64_t acc, uint64_t input) {
+    acc += input * XXH_PRIME64_2;
+    acc = xxh_rotl(acc, 31);
+    return acc * XXH_PRIME64_1;
+}
+
+static uint64_t xxh64_merge(uint64_t acc, uint64_t val) {
+    acc ^= xxh64_round(0, val);
+    return acc * XXH_PRIME64_1 + XXH_PRIME64_4;
+}
+
+uint64_t xxh64(const void *input, size_t len, uint64_t seed) {
+    const unsigned char *p = input;
+    const unsigned char *end = p + len;
+    uint64_t h;
+
+    if (len >= 32) {
+        uint64_t v1 = seed + XXH_PRIME64_1 + XXH_PRIME64_2;
+        uint64_t v2 = seed + XXH_PRIME64_2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - XXH_PRIME64_1;
+        do {
+            v1 = xxh64_round(v1, xxh_read64(p));
+            v2 = xxh64_round(v2, xxh_read64(p + 8));
+            v3 = xxh64_round(v3, xxh_read64(p + 16));
+            v4 = xxh64_round(v4, xxh_read64(p + 24));
+            p += 32;
+        } while (p + 32 <= end);
+        h = xxh_rotl(v1, 1) + xxh_rotl(v2, 7) + xxh_rotl(v3, 12) + xxh_rotl(v4, 18);
+        h = xxh64_merge(h, v1);
+        h = xxh64_merge(h, v2);
+        h = xxh64_merge(h, v3);
+        h = xxh64_merge(h, v4);
+    } else {
+        h = seed + XXH_PRIME64_5;
+    }
+    h += (uint64_t)len;
+
+    while (p + 8 <= end) {
+        h ^= xxh64_round(0, xxh_read64(p));
+        h = xxh_rotl(h, 27) * XXH_PRIME64_1 + XXH_PRIME64_4;
+        p += 8;
+    }
+    if (p + 4 <= end) {
+        h ^= (uint64_t)xxh_read32(p) * XXH_PRIME64_1;
+        h = xxh_rotl(h, 23) * XXH_PRIME64_2 + XXH_PRIME64_3;
+        p += 4;
+    }
+    while (p < end) {
+        h ^= (*p) * XXH_PRIME64_5;
+        h = xxh_rotl(h, 11) * XXH_PRIME64_1;
+        p++;
+    }
+    h ^= h >> 33;
+    h *= XXH_PRIME64_2;
+    h ^= h >> 29;
+    h *= XXH_PRIME64_3;
+    h ^= h >> 32;
+    return h;
+}
+
+// Hash a whole file through mmap, seed lets several files be chained into one hash
+uint64_t hash_file(const char *path, uint64_t seed, long *size) {
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) == -1) {
+        if (fd != -1) close(fd);
+        *size = -1;
+        return 0;
+    }
+    *size = st.st_size;
+    if (st.st_size == 0) {
+        close(fd);
+        return xxh64("", 0, seed);
+    }
+    void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        *size = -1;
+        return 0;
+    }
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+    uint64_t hash = xxh64(data, st.st_size, seed);
+    munmap(data, st.st_size);
+    return hash;
+}
+
+
+// One manifest line: an input, its content hash and the options its outputs were made with
+typedef struct {
+    char *path;
+    long size;
+    uint64_t hash;
+    uint64_t options;
+} CacheEntry;
+
+// Cache manifest kept at <output>/.get_seq.cache, gene-centric records of each genome under .get_seq_cache/
+typedef struct {
+    CacheEntry *entries;
+    int count;
+    int capacity;
+    int *slots;
+    int slot_count;
+    char *manifest_path;
+    char *fragment_dir;
+    int reused;
+    int processed;
+} Cache;
+
+static int *cache_slot(Cache *cache, const char *path) {
+    unsigned long mask = cache->slot_count - 1;
+    unsigned long h = hash_string(path) & mask;
+    while (cache->slots[h] != -1 && strcmp(cache->entries[cache->slots[h]].path, path) != 0) {
+        h = (h + 1) & mask;
+    }
+    return &cache->slots[h];
+}
+
+CacheEntry* cache_lookup(Cache *cache, const char *path) {
+    int *slot = cache_slot(cache, path);
+    return *slot == -1 ? NULL : &cache->entries[*slot];
+}
+
+void cache_update(Cache *cache, const char *path, long size, uint64_t hash, uint64_t options) {
+    int *slot = cache_slot(cache, path);
+    if (*slot == -1) {
+        if (cache->count == cache->capacity) {
+            cache->capacity *= 2;
+            cache->entries = realloc(cache->entries, sizeof(CacheEntry) * cache->capacity);
+            if (cache->entries == NULL) {
+                log_print(ERROR, "Failed to allocate memory for cache manifest");
+                exit(EXIT_FAILURE);
+            }
+        }
+        cache->entries[cache->count].path = strdup(path);
+        *slot = cache->count++;
+
+        if (cache->count * 2 > cache->slot_count) {
+            cache->slot_count *= 2;
+            cache->slots = realloc(cache->slots, sizeof(int) * cache->slot_count);
+            if (cache->slots == NULL) {
+                log_print(ERROR, "Failed to allocate memory for cache manifest");
+                exit(EXIT_FAILURE);
+            }
+            memset(cache->slots, -1, sizeof(int) * cache->slot_count);
+            for (int i = 0; i < cache->count; i++) {
+                *cache_slot(cache, cache->entries[i].path) = i;
+            }
+        }
+        slot = cache_slot(cache, path);
+    }
+    CacheEntry *entry = &cache->entries[*slot];
+    entry->size = size;
+    entry->hash = hash;
+    entry->options = options;
+}
+
+Cache* cache_load(const char *output_file) {
+    Cache *cache = calloc(1, sizeof(Cache));
+    cache->capacity = 256;
+    cache->entries = malloc(sizeof(CacheEntry) * cache->capacity);
+    cache->slot_count = 512;
+    cache->slots = malloc(sizeof(int) * cache->slot_count);
+    cache->manifest_path = malloc(strlen(output_file) + 32);
+    cache->fragment_dir = malloc(strlen(output_file) + 32);
+    if (cache->entries == NULL || cache->slots == NULL || cache->manifest_path == NULL || cache->fragment_dir == NULL) {
+        log_print(ERROR, "Failed to allocate memory for cache manifest");
+        exit(EXIT_FAILURE);
+    }
+    memset(cache->slots, -1, sizeof(int) * cache->slot_count);
+    sprintf(cache->manifest_path, "%s.get_seq.cache", output_file);
+    sprintf(cache->fragment_dir, "%s.get_seq_cache/", output_file);
+    mkdir(cache->fragment_dir, 0755);
+
+    FILE *fp = fopen(cache->manifest_path, "r");
+    if (fp == NULL) {
+        return cache;
+    }
+    char *line = NULL;
+    size_t line_cap = 0;
+    while (getline(&line, &line_cap, fp) != -1) {
+        if (line[0] == '#') {
+            continue;
+        }
+        char *tab = strchr(line, '\t');
+        long size;
+        unsigned long long hash, options;
+        if (tab == NULL || sscanf(tab + 1, "%ld\t%llx\t%llx", &size, &hash, &options) != 3) {
+            continue;
+        }
+        *tab = '\0';
+        cache_update(cache, line, size, hash, options);
+    }
+    free(line);
+    fclose(fp);
+    log_print(INFO, "Cache manifest %s: %d entries", cache->manifest_path, cache->count);
+    return cache;
+}
+
+void cache_save(Cache *cache) {
+    char *temp_path = malloc(strlen(cache->manifest_path) + 8);
+    sprintf(temp_path, "%s.tmp", cache->manifest_path);
+    FILE *fp = fopen(temp_path, "w");
+    if (fp == NULL) {
+        log_print(WARNING, "Failed to write cache manifest '%s'", cache->manifest_path);
+    } else {
+        fprintf(fp, "#path\tsize\thash\toptions\n");
+        for (int i = 0; i < cache->count; i++) {
+            fprintf(fp, "%s\t%ld\t%016llx\t%016llx\n", cache->entries[i].path, cache->entries[i].size, (unsigned long long)cache->entries[i].hash, (unsigned long long)cache->entries[i].options);
+        }
+        fclose(fp);
+        rename(temp_path, cache->manifest_path);
+    }
+    log_print(INFO, "Cache: %d inputs reused, %d processed", cache->reused, cache->processed);
+
+    for (int i = 0; i < cache->count; i++) {
+        free(cache->entries[i].path);
+    }
+    free(temp_path);
+    free(cache->entries);
+    free(cache->slots);
+    free(cache->manifest_path);
+    free(cache->fragment_dir);
+    free(cache);
+}
+
+// Cached gene-centric records of one genome version
+void cache_fragment_path(Cache *cache, uint64_t hash, uint64_t options, char *path) {
+    sprintf(path, "%s%016llx%016llx.frag", cache->fragment_dir, (unsigned long long)hash, (unsigned long long)options);
+}
+
+// Feed the cached records of an unchanged genome back into the gene files, 0 if the fragment is gone
+int cache_replay_fragment(GenePool *pool, const char *fragment_path) {
+    FILE *fp = fopen(fragment_path, "r");
+    if (fp == NULL) {
+        return 0;
+    }
+    char *line = NULL;
+    size_t line_cap = 0;
+    ssize_t line_len;
+    while ((line_len = getline(&line, &line_cap, fp)) != -1) {
+        if (line_len > 0 && line[line_len - 1] == '\n') {
+            line[line_len - 1] = '\0';
+        }
+        char *header = strchr(line, '\t');
+        char *sequence = header ? strchr(header + 1, '\t') : NULL;
+        if (sequence == NULL) {
+            continue;
+        }
+        *header++ = '\0';
+        *sequence++ = '\0';
+        gene_pool_append(pool, line, header, sequence);
+    }
+    free(line);
+    fclose(fp);
+    return 1;
+}
+
+// Do the per-genome outputs of an earlier run still exist
+int outputs_exist(const char *output_file, const char *prefix, int faa_flag, int pep_flag, int cds_flag, int trn_flag, int rrn_flag) {
+    const char *exts[] = {"faa", "pep", "cds", "trn", "rrn"};
+    int flags[] = {faa_flag, pep_flag, cds_flag, trn_flag, rrn_flag};
+    char path[2048];
+    for (int i = 0; i < 5; i++) {
+        sprintf(path, "%s%s.%s", output_file, prefix, exts[i]);
+        if (flags[i] == 1 && access(path, F_OK) == -1) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+
+// Append one genome's features to the gene-centric files, headers are "<accession> <organism>"
+void write_gene_records(GenePool *pool, int pep_flag, int cds_flag, int trn_flag, int rrn_flag, int cds_count, int rrn_count, int trn_count, Cds *cds_list, Pep *pep_list, Rrn *rrn_list, Trn *trn_list, const char *organism, const char *accession, const char *prefix) {
+    char header[MAX_LINE_LEN];
+    char name[MAX_GENE_LEN];
+    char file_name[MAX_GENE_LEN + 16];
+
+    // the first accession token identifies the genome, fall back to the file prefix
+    if (accession != NULL && strlen(accession) > 0) {
+        snprintf(header, sizeof(header), "%.*s %s", (int)strcspn(accession, " "), accession, organism);
+    } else {
+        snprintf(header, sizeof(header), "%s %s", prefix, organism);
+    }
+
+    for (int i = 0; i < cds_count; i++) {
+        if (cds_list[i].gene == NULL) {
+            continue;
+        }
+        normalize_gene_name(cds_list[i].gene, name);
+        if (cds_flag == 1 && cds_list[i].sequence != NULL) {
+            sprintf(file_name, "%s.fasta", name);
+            gene_pool_append(pool, file_name, header, cds_list[i].sequence);
+        }
+        // a CDS whose location falls outside the genome is skipped, with its translation
+        if (pep_flag == 1 && cds_list[i].sequence != NULL && pep_list[i].sequence != NULL && pep_list[i].sequence[0] != '\0') {
+            sprintf(file_name, "%s.pep.fasta", name);
+            gene_pool_append(pool, file_name, header, pep_list[i].sequence);
+        }
+    }
+    for (int i = 0; rrn_flag == 1 && i < rrn_count; i++) {
+        if (rrn_list[i].gene == NULL || rrn_list[i].sequence == NULL) {
+            continue;
+        }
+        normalize_gene_name(rrn_list[i].gene, name);
+        sprintf(file_name, "%s.fasta", name);
+        gene_pool_append(pool, file_name, header, rrn_list[i].sequence);
+    }
+    for (int i = 0; trn_flag == 1 && i < trn_count; i++) {
+        if (trn_list[i].gene == NULL || trn_list[i].sequence == NULL) {
+            continue;
+        }
+        normalize_gene_name(trn_list[i].gene, name);
+        sprintf(file_name, "%s.fasta", name);
+        gene_pool_append(pool, file_name, header, trn_list[i].sequence);
+    }
+}
+
+
+// Write one genome's annotations to <output>/<prefix>.{cds,rrn,trn,pep,faa}
+void write_annotations(const char *output_file, const char *prefix, int faa_flag, int pep_flag, int cds_flag, int trn_flag, int rrn_flag, int cds_count, int rrn_count, int trn_count, Cds *cds_list, Faa *faa, Pep *pep_list, Rrn *rrn_list, Trn *trn_list) {
+    char output_path[2048];
+
+    // Print the annotations
+    if (cds_flag == 1) {
+        sprintf(output_path, "%s%s.cds", output_file, prefix);
+        FILE *fcds = fopen(output_path, "w");
+        for (int i = 0; i < cds_count; i++)
+        {
+            if (cds_list[i].sequence == NULL) {
+                continue;
+            }
+            fprintf(fcds, ">%s\n", cds_list[i].gene);
+            fprintf(fcds, "%s\n", cds_list[i].sequence);
+        }
+        fclose(fcds);
+        log_print(INFO, "CDS sequences saved to %s", output_path);
+    }
+
+    if (rrn_flag == 1) {
+        sprintf(output_path, "%s%s.rrn", output_file, prefix);
+        FILE *frrn = fopen(output_path, "w");
+        for (int i = 0; i < rrn_count; i++)
+        {
+            if (rrn_list[i].sequence == NULL) {
+                continue;
+            }
+            fprintf(frrn, ">%s\n", rrn_list[i].gene);
+            fprintf(frrn, "%s\n", rrn_list[i].sequence);
+        }
+        fclose(frrn);
+        log_print(INFO, "rRNA sequences saved to %s", output_path);
+    }
+
+
+    if (trn_flag == 1) {
+        sprintf(output_path, "%s%s.trn", output_file, prefix);
+        FILE *ftrn = fopen(output_path, "w");
+        for (int i = 0; i < trn_count; i++)
+        {
+            if (trn_list[i].sequence == NULL) {
+                continue;
+            }
+            fprintf(ftrn, ">%s\n", trn_list[i].gene);
+            fprintf(ftrn, "%s\n", trn_list[i].sequence);
+        }
+        fclose(ftrn);
+        log_print(INFO, "tRNA sequences saved to %s", output_path);
+    }
+
+    
+    if (pep_flag == 1) {
+        sprintf(output_path, "%s%s.pep", output_file, prefix);
+        FILE *fpep = fopen(output_path, "w");
+        for (int i = 0; i < cds_count; i++)
+        {
+            if (cds_list[i].sequence == NULL || pep_list[i].sequence == NULL || pep_list[i].sequence[0] == '\0') {
+                continue;
+            }
+            fprintf(fpep, ">%s\n", pep_list[i].gene);
+            fprintf(fpep, "%s\n", pep_list[i].sequence);
+        }
+        fclose(fpep);
+        log_print(INFO, "Pep sequences saved to %s", output_path);
+    }
+
+    if (faa_flag == 1) {
+        sprintf(output_path, "%s%s.faa", output_file, prefix);
+        FILE *ffaa = fopen(output_path, "w");
+        fprintf(ffaa, ">%s", faa->gene);
+        fprintf(ffaa, "%s\n", faa->sequence);
+        fclose(ffaa);
+        log_print(INFO, "Faa sequences saved to %s", output_path);
+    }
+}
+
+
+
+// Serve mode: answer extraction requests over a Unix domain socket, keeping parsed inputs in memory.
+// Every message is a 4-byte big-endian length followed by that many bytes. A request is one line of
+// tab-separated fields; the reply starts with "OK\n" or "ERROR <reason>\n"
+#define DEFAULT_SERVE_CACHE 64
+#define MAX_REQUEST_LEN (1 << 20)
+
+// One genome's gene order: gene IDs in genomic order, negative on the minus strand
+typedef struct {
+    char *name;
+    int *order;
+    int count;
+    uint64_t *adjacencies;
+    int adjacency_count;
+    uint64_t *content;
+    uint64_t *single;
+} GeneOrder;
+
+// Gene names shared by all genomes, the ID of a gene is its index + 1
+typedef struct {
+    char **names;
+    int count;
+    int capacity;
+    int *slots;
+    int slot_count;
+} GeneDictionary;
+
+// A feature placed on the genome, used to sort the features of all types together
+typedef struct {
+    int start;
+    int index;
+    int gene;
+} PlacedFeature;
+
+// The pairwise comparison shared by the worker threads, rows are written in genome order
+typedef struct {
+    GeneOrder *orders;
+    int order_count;
+    int gene_count;
+    int words;
+    int next_row;
+    int next_write;
+    char **rows;
+    size_t *row_lengths;
+    FILE *output;
+    pthread_mutex_t lock;
+} GeneOrderJob;
+
+int gene_dictionary_id(GeneDictionary *dict, const char *name) {
+    if (dict->slot_count == 0 || dict->count * 2 >= dict->slot_count) {
+        int slot_count = dict->slot_count == 0 ? 256 : dict->slot_count * 2;
+        int *slots = malloc(sizeof(int) * slot_count);
+        if (slots == NULL) {
+            log_print(ERROR, "Failed to allocate memory for gene dictionary");
+            exit(EXIT_FAILURE);
+        }
+        memset(slots, -1, sizeof(int) * slot_count);
+        for (int i = 0; i < dict->count; i++) {
+            unsigned long h = hash_string(dict->names[i]) & (slot_count - 1);
+            while (slots[h] != -1) {
+                h = (h + 1) & (slot_count - 1);
+            }
+            slots[h] = i;
+        }
+        free(dict->slots);
+        dict->slots = slots;
+        dict->slot_count = slot_count;
+    }
+
+    unsigned long mask = dict->slot_count - 1;
+    unsigned long h = hash_string(name) & mask;
+    while (dict->slots[h] != -1) {
+        if (strcmp(dict->names[dict->slots[h]], name) == 0) {
+            return dict->slots[h] + 1;
+        }
+        h = (h + 1) & mask;
+    }
+
+    if (dict->count == dict->capacity) {
+        dict->capacity = dict->capacity == 0 ? 64 : dict->capacity * 2;
+        dict->names = realloc(dict->names, sizeof(char *) * dict->capacity);
+        if (dict->names == NULL) {
+            log_print(ERROR, "Failed to allocate memory for gene dictionary");
+            exit(EXIT_FAILURE);
+        }
+    }
+    dict->names[dict->count] = strdup(name);
+    dict->slots[h] = dict->count;
+    return ++dict->count;
+}
+
+// First coordinate and strand of a location, e.g. complement(join(100..200,300..400))
+static int feature_start(const char *location, int *strand) {
+    *strand = strstr(location, "complement(") != NULL ? -1 : 1;
+    while (*location != '\0' && !isdigit((unsigned char)*location)) {
+        location++;
+    }
+    return atoi(location);
+}
+
+static void place_feature(GeneDictionary *dict, PlacedFeature *placed, int *count, const char *gene, const char *location) {
+    char name[MAX_GENE_LEN];
+    int strand;
+    if (gene == NULL || location == NULL) {
+        return;
+    }
+    normalize_gene_name(gene, name);
+    placed[*count].start = feature_start(location, &strand);
+    placed[*count].index = *count;
+    placed[*count].gene = strand * gene_dictionary_id(dict, name);
+    (*count)++;
+}
+
+static int compare_placed_features(const void *a, const void *b) {
+    const PlacedFeature *x = a, *y = b;
+    if (x->start != y->start) {
+        return x->start < y->start ? -1 : 1;
+    }
+    return x->index - y->index;
+}
+
+// Encode the CDS, rRNA and tRNA features of one genome as signed gene IDs sorted by position
+void collect_gene_order(GeneDictionary *dict, GeneOrder *order, int cds_count, int rrn_count, int trn_count, Cds *cds_list, Rrn *rrn_list, Trn *trn_list, const char *accession, const char *prefix) {
+    PlacedFeature *placed = malloc(sizeof(PlacedFeature) * (cds_count + rrn_count + trn_count + 1));
+    int count = 0;
+    if (placed == NULL) {
+        log_print(ERROR, "Failed to allocate memory for gene order");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < cds_count; i++) {
+        place_feature(dict, placed, &count, cds_list[i].gene, cds_list[i].location);
+    }
+    for (int i = 0; i < rrn_count; i++) {
+        place_feature(dict, placed, &count, rrn_list[i].gene, rrn_list[i].location);
+    }
+    for (int i = 0; i < trn_count; i++) {
+        place_feature(dict, placed, &count, trn_list[i].gene, trn_list[i].location);
+    }
+    qsort(placed, count, sizeof(PlacedFeature), compare_placed_features);
+
+    memset(order, 0, sizeof(GeneOrder));
+    if (accession != NULL && strlen(accession) > 0) {
+        order->name = strndup(accession, strcspn(accession, " "));
+    } else {
+        order->name = strdup(prefix);
+    }
+    order->order = malloc(sizeof(int) * (count + 1));
+    order->count = count;
+    for (int i = 0; i < count; i++) {
+        order->order[i] = placed[i].gene;
+    }
+    free(placed);
+}
+
+// An adjacency and its reading on the other strand, (a, b) == (-b, -a), share one key
+static uint64_t adjacency_key(int a, int b) {
+    uint64_t forward = ((uint64_t)(uint32_t)a << 32) | (uint32_t)b;
+    uint64_t reverse = ((uint64_t)(uint32_t)-b << 32) | (uint32_t)-a;
+    return forward < reverse ? forward : reverse;
+}
+
+static int compare_keys(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+// Sorted distinct adjacency keys of a circular gene order, returns their number
+static int build_adjacencies(const int *order, int count, uint64_t *keys) {
+    if (count < 2) {
+        return 0;
+    }
+    for (int i = 0; i < count; i++) {
+        keys[i] = adjacency_key(order[i], order[(i + 1) % count]);
+    }
+    qsort(keys, count, sizeof(uint64_t), compare_keys);
+    int n = 1;
+    for (int i = 1; i < count; i++) {
+        if (keys[i] != keys[n - 1]) {
+            keys[n++] = keys[i];
+        }
+    }
+    return n;
+}
+
+static int shared_adjacencies(const uint64_t *a, int a_count, const uint64_t *b, int b_count) {
+    int i = 0, j = 0, shared = 0;
+    while (i < a_count && j < b_count) {
+        if (a[i] < b[j]) {
+            i++;
+        } else if (a[i] > b[j]) {
+            j++;
+        } else {
+            shared++, i++, j++;
+        }
+    }
+    return shared;
+}
+
+static int has_gene(const uint64_t *set, int gene) {
+    gene = abs(gene);
+    return (set[gene >> 6] >> (gene & 63)) & 1;
+}
+
+static int keep_genes(const int *order, int count, const uint64_t *mask, int *kept) {
+    int n = 0;
+    for (int i = 0; i < count; i++) {
+        if (has_gene(mask, order[i])) {
+            kept[n++] = order[i];
+        }
+    }
+    return n;
+}
+
+// Content bitsets and adjacency keys of every genome, once the dictionary is complete
+void index_gene_orders(GeneOrder *orders, int order_count, int words) {
+    for (int n = 0; n < order_count; n++) {
+        GeneOrder *order = &orders[n];
+        uint64_t *seen = calloc(words, sizeof(uint64_t));
+        order->content = calloc(words, sizeof(uint64_t));
+        order->single = calloc(words, sizeof(uint64_t));
+        order->adjacencies = malloc(sizeof(uint64_t) * (order->count + 1));
+        if (seen == NULL || order->content == NULL || order->single == NULL || order->adjacencies == NULL) {
+            log_print(ERROR, "Failed to allocate memory for gene order");
+            exit(EXIT_FAILURE);
+        }
+        for (int i = 0; i < order->count; i++) {
+            int gene = abs(order->order[i]);
+            if (has_gene(order->content, gene)) {
+                seen[gene >> 6] |= 1ULL << (gene & 63);
+            }
+            order->content[gene >> 6] |= 1ULL << (gene & 63);
+        }
+        for (int w = 0; w < words; w++) {
+            order->single[w] = order->content[w] & ~seen[w];
+        }
+        order->adjacency_count = build_adjacencies(order->order, order->count, order->adjacencies);
+        free(seen);
+    }
+}
+
+// Common intervals of 2 to n-1 genes, over the genes found once in each genome. Both orders are
+// read circularly from the first such gene of a, on the strand where it is forward
+static int common_intervals(const int *a, int a_count, const int *b, int b_count, int *position) {
+    if (a_count < 3 || a_count != b_count) {
+        return 0;
+    }
+    int anchor = 0;
+    while (abs(b[anchor]) != abs(a[0])) {
+        anchor++;
+    }
+    int step = (b[anchor] == a[0]) ? 1 : b_count - 1;
+    for (int k = 0, i = anchor; k < b_count; k++, i = (i + step) % b_count) {
+        position[abs(b[i])] = k;
+    }
+
+    int count = 0;
+    for (int i = 0; i < a_count - 1; i++) {
+        int low = position[abs(a[i])], high = low;
+        for (int j = i + 1; j < a_count && j - i + 1 < a_count; j++) {
+            int p = position[abs(a[j])];
+            if (p < low) low = p;
+            if (p > high) high = p;
+            if (high - low == j - i) {
+                count++;
+            }
+        }
+    }
+    return count;
+}
+
+static void compare_gene_orders(FILE *fp, const GeneOrder *a, const GeneOrder *b, int words, uint64_t *mask, int *kept_a, int *kept_b, uint64_t *keys_a, uint64_t *keys_b, int *position) {
+    int shared_genes = 0, adjacencies, shared;
+
+    for (int w = 0; w < words; w++) {
+        mask[w] = a->content[w] & b->content[w];
+        shared_genes += __builtin_popcountll(mask[w]);
+    }
+
+    // breakpoints are counted on the genes both genomes carry
+    if (memcmp(a->content, b->content, sizeof(uint64_t) * words) == 0) {
+        shared = shared_adjacencies(a->adjacencies, a->adjacency_count, b->adjacencies, b->adjacency_count);
+        adjacencies = a->adjacency_count > b->adjacency_count ? a->adjacency_count : b->adjacency_count;
+    } else {
+        int a_count = build_adjacencies(kept_a, keep_genes(a->order, a->count, mask, kept_a), keys_a);
+        int b_count = build_adjacencies(kept_b, keep_genes(b->order, b->count, mask, kept_b), keys_b);
+        shared = shared_adjacencies(keys_a, a_count, keys_b, b_count);
+        adjacencies = a_count > b_count ? a_count : b_count;
+    }
+
+    for (int w = 0; w < words; w++) {
+        mask[w] = a->single[w] & b->single[w];
+    }
+    int a_count = keep_genes(a->order, a->count, mask, kept_a);
+    int b_count = keep_genes(b->order, b->count, mask, kept_b);
+    int intervals = common_intervals(kept_a, a_count, kept_b, b_count, position);
+
+    fprintf(fp, "%s\t%s\t%d\t%d\t%d\t%d\t%d\t%d\n", a->name, b->name, a->count, b->count, shared_genes, shared, adjacencies - shared, intervals);
+}
+
+static void* gene_order_worker(void *arg) {
+    GeneOrderJob *job = arg;
+    int longest = 1;
+    for (int n = 0; n < job->order_count; n++) {
+        if (job->orders[n].count > longest) {
+            longest = job->orders[n].count;
+        }
+    }
+    uint64_t *mask = malloc(sizeof(uint64_t) * job->words);
+    int *kept_a = malloc(sizeof(int) * longest);
+    int *kept_b = malloc(sizeof(int) * longest);
+    uint64_t *keys_a = malloc(sizeof(uint64_t) * longest);
+    uint64_t *keys_b = malloc(sizeof(uint64_t) * longest);
+    int *position = malloc(sizeof(int) * (job->gene_count + 1));
+    if (mask == NULL || kept_a == NULL || kept_b == NULL || keys_a == NULL || keys_b == NULL || position == NULL) {
+        log_print(ERROR, "Failed to allocate memory for gene order comparison");
+        exit(EXIT_FAILURE);
+    }
+
+    for (;;) {
+        pthread_mutex_lock(&job->lock);
+        int row = job->next_row++;
+        pthread_mutex_unlock(&job->lock);
+        if (row >= job->order_count) {
+            break;
+        }
+
+        char *data = NULL;
+        size_t length = 0;
+        FILE *fp = open_memstream(&data, &length);
+        for (int j = row + 1; j < job->order_count; j++) {
+            compare_gene_orders(fp, &job->orders[row], &job->orders[j], job->words, mask, kept_a, kept_b, keys_a, keys_b, position);
+        }
+        fclose(fp);
+
+        // hand the row over and write every finished row that is next in order
+        pthread_mutex_lock(&job->lock);
+        job->rows[row] = data;
+        job->row_lengths[row] = length;
+        while (job->next_write < job->order_count && job->rows[job->next_write] != NULL) {
+            fwrite(job->rows[job->next_write], 1, job->row_lengths[job->next_write], job->output);
+            free(job->rows[job->next_write]);
+            job->rows[job->next_write] = NULL;
+            job->next_write++;
+        }
+        pthread_mutex_unlock(&job->lock);
+    }
+
+    free(mask);
+    free(kept_a);
+    free(kept_b);
+    free(keys_a);
+    free(keys_b);
+    free(position);
+    return NULL;
+}
+
+// Write <output>/gene_order.tsv (one line per genome) and <output>/gene_order_pairs.tsv (every pair)
+void write_gene_orders(const char *output_file, GeneDictionary *dict, GeneOrder *orders, int order_count, int threads) {
+    char path[2048];
+    int words = dict->count / 64 + 1;
+
+    sprintf(path, "%sgene_order.tsv", output_file);
+    FILE *fp = fopen(path, "w");
+    if (fp == NULL) {
+        log_print(ERROR, "Failed to open %s", path);
+        exit(EXIT_FAILURE);
+    }
+    fprintf(fp, "Genome\tGenes\tEncoded\tOrder\n");
+    for (int n = 0; n < order_count; n++) {
+        fprintf(fp, "%s\t%d\t", orders[n].name, orders[n].count);
+        for (int i = 0; i < orders[n].count; i++) {
+            fprintf(fp, i == 0 ? "%d" : ",%d", orders[n].order[i]);
+        }
+        fputc('\t', fp);
+        for (int i = 0; i < orders[n].count; i++) {
+            int gene = orders[n].order[i];
+            fprintf(fp, "%s%s%s", i == 0 ? "" : " ", gene < 0 ? "-" : "", dict->names[abs(gene) - 1]);
+        }
+        fputc('\n', fp);
+    }
+    fclose(fp);
+
+    index_gene_orders(orders, order_count, words);
+
+    sprintf(path, "%sgene_order_pairs.tsv", output_file);
+    GeneOrderJob job;
+    memset(&job, 0, sizeof(job));
+    job.orders = orders;
+    job.order_count = order_count;
+    job.gene_count = dict->count;
+    job.words = words;
+    job.rows = calloc(order_count + 1, sizeof(char *));
+    job.row_lengths = calloc(order_count + 1, sizeof(size_t));
+    job.output = fopen(path, "w");
+    if (job.output == NULL || job.rows == NULL || job.row_lengths == NULL) {
+        log_print(ERROR, "Failed to open %s", path);
+        exit(EXIT_FAILURE);
+    }
+    fprintf(job.output, "Genome_A\tGenome_B\tGenes_A\tGenes_B\tShared_genes\tShared_adjacencies\tBreakpoints\tCommon_intervals\n");
+    pthread_mutex_init(&job.lock, NULL);
+
+    pthread_t *workers = malloc(sizeof(pthread_t) * threads);
+    for (int t = 0; t < threads; t++) {
+        pthread_create(&workers[t], NULL, gene_order_worker, &job);
+    }
+    for (int t = 0; t < threads; t++) {
+        pthread_join(workers[t], NULL);
+    }
+    free(workers);
+    pthread_mutex_destroy(&job.lock);
+    fclose(job.output);
+    free(job.rows);
+    free(job.row_lengths);
+    log_print(INFO, "Gene order of %d genomes (%d genes) compared on %d threads", order_count, dict->count, threads);
+}
+
+void free_gene_orders(GeneDictionary *dict, GeneOrder *orders, int order_count) {
+    for (int n = 0; n < order_count; n++) {
+        free(orders[n].name);
+        free(orders[n].order);
+        free(orders[n].adjacencies);
+        free(orders[n].content);
+        free(orders[n].single);
+    }
+    free(orders);
+    for (int i = 0; i < dict->count; i++) {
+        free(dict->names[i]);
+    }
+    free(dict->names);
+    free(dict->slots);
+}
+
+
+// Define a struct to hold the base composition of a genome sequence
+typedef struct {
+    long length;
+    long acgt;
+    long n;
+    long ambiguous;     // IUPAC codes other than N
+    long invalid;
+    long n_runs;
+    long longest_n_run;
+} BaseCounts;
+
+// Amino acids of the NCBI genetic codes (/transl_table), codons in TCAG order
+static const struct {
+    int table;
+    const char *amino_acids;
+} GENETIC_CODES[] = {
+    {1, "FFLLSSSSYY**CC*WLLLLPPPPHHQQRRRRIIIMTTTTNNKKSSRRVVVVAAAADDEEGGGG"},
+    {2, "FFLLSSSSYY**CC*WLLLLPPPPHHQQRRRRIIMMTTTTNNKKSS**VVVVAAAADDEEGGGG"},
+    {3, "FFLLSSSSYY**CCWWTTTTPPPPHHQQRRRRIIMMTTTTNNKKSSRRVVVVAAAADDEEGGGG"},
+    {4, "FFLLSSSSYY**CCWWLLLLPPPPHHQQRRRRIIIMTTTTNNKKSSRRVVVVAAAADDEEGGGG"},
+    {5, "FFLLSSSSYY**CCWWLLLLPPPPHHQQRRRRIIMMTTTTNNKKSSSSVVVVAAAADDEEGGGG"},
+    {6, "FFLLSSSSYYQQCC*WLLLLPPPPHHQQRRRRIIIMTTTTNNKKSSRRVVVVAAAADDEEGGGG"},
+    {9, "FFLLSSSSYY**CCWWLLLLPPPPHHQQRRRRIIIMTTTTNNNKSSSSVVVVAAAADDEEGGGG"},
+    {10, "FFLLSSSSYY**CCCWLLLLPPPPHHQQRRRRIIIMTTTTNNKKSSRRVVVVAAAADDEEGGGG"},
+    {11, "FFLLSSSSYY**CC*WLLLLPPPPHHQQRRRRIIIMTTTTNNKKSSRRVVVVAAAADDEEGGGG"},
+    {12, "FFLLSSSSYY**CC*WLLLSPPPPHHQQRRRRIIIMTTTTNNKKSSRRVVVVAAAADDEEGGGG"},
+    {13, "FFLLSSSSYY**CCWWLLLLPPPPHHQQRRRRIIMMTTTTNNKKSSGGVVVVAAAADDEEGGGG"},
+    {14, "FFLLSSSSYYY*CCWWLLLLPPPPHHQQRRRRIIIMTTTTNNNKSSSSVVVVAAAADDEEGGGG"},
+    {16, "FFLLSSSSYY*LCC*WLLLLPPPPHHQQRRRRIIIMTTTTNNKKSSRRVVVVAAAADDEEGGGG"},
+    {21, "FFLLSSSSYY**CCWWLLLLPPPPHHQQRRRRIIMMTTTTNNNKSSSSVVVVAAAADDEEGGGG"},
+    {22, "FFLLSS*SYY*LCC*WLLLLPPPPHHQQRRRRIIIMTTTTNNKKSSRRVVVVAAAADDEEGGGG"},
+    {23, "FF*LSSSSYY**CC*WLLLLPPPPHHQQRRRRIIIMTTTTNNKKSSRRVVVVAAAADDEEGGGG"},
+    {24, "FFLLSSSSYY**CCWWLLLLPPPPHHQQRRRRIIIMTTTTNNKKSSSKVVVVAAAADDEEGGGG"},
+    {25, "FFLLSSSSYY**CCGWLLLLPPPPHHQQRRRRIIIMTTTTNNKKSSRRVVVVAAAADDEEGGGG"},
+    {26, "FFLLSSSSYY**CC*WLLLAPPPPHHQQRRRRIIIMTTTTNNKKSSRRVVVVAAAADDEEGGGG"},
+    {33, "FFLLSSSSYYY*CCWWLLLLPPPPHHQQRRRRIIIMTTTTNNKKSSSKVVVVAAAADDEEGGGG"},
+};
+
+// The code of a /transl_table, the standard code (1) for none or an unknown table
+static const char* genetic_code(int table, int *used) {
+    for (size_t i = 0; i < sizeof(GENETIC_CODES) / sizeof(GENETIC_CODES[0]); i++) {
+        if (GENETIC_CODES[i].table == table) {
+            *used = table;
+            return GENETIC_CODES[i].amino_acids;
+        }
+    }
+    *used = 1;
+    return GENETIC_CODES[0].amino_acids;
+}
+
+static int codon_base(char c) {
+    switch (c) {
+        case 'T': case 't': case 'U': case 'u': return 0;
+        case 'C': case 'c': return 1;
+        case 'A': case 'a': return 2;
+        case 'G': case 'g': return 3;
+    }
+    return -1;
+}
+
+// 0 ACGT, 1 N, 2 other IUPAC code, 3 anything else
+static int base_class(char c) {
+    switch (c | 0x20) {
+        case 'a': case 'c': case 'g': case 't': return 0;
+        case 'n': return 1;
+        case 'r': case 'y': case 'k': case 'm': case 's': case 'w': case 'b': case 'd': case 'h': case 'v': return 2;
+    }
+    return 3;
+}
+
+static void end_n_run(BaseCounts *counts, long *run) {
+    if (*run > 0) {
+        counts->n_runs++;
+        if (*run > counts->longest_n_run) {
+            counts->longest_n_run = *run;
+        }
+        *run = 0;
+    }
+}
+
+static void count_base(BaseCounts *counts, long *run, char c) {
+    int class = base_class(c);
+    if (class == 1) {
+        counts->n++;
+        (*run)++;
+        return;
+    }
+    end_n_run(counts, run);
+    if (class == 0) {
+        counts->acgt++;
+    } else if (class == 2) {
+        counts->ambiguous++;
+    } else {
+        counts->invalid++;
+    }
+}
+
+// Base composition and N runs. With SSE2, 16 bytes are classified at once and only blocks holding
+// something other than ACGT/N, or a mix of N and ACGT, are looked at byte by byte
+void classify_bases(const char *seq, size_t len, BaseCounts *counts) {
+    size_t i = 0;
+    long run = 0;
+    memset(counts, 0, sizeof(BaseCounts));
+    counts->length = len;
+#ifdef __SSE2__
+    const __m128i fold = _mm_set1_epi8(0x20);
+    const __m128i a = _mm_set1_epi8('a'), c = _mm_set1_epi8('c'), g = _mm_set1_epi8('g'), t = _mm_set1_epi8('t'), n = _mm_set1_epi8('n');
+    for (; i + 16 <= len; i += 16) {
+        __m128i block = _mm_or_si128(_mm_loadu_si128((const __m128i *)(seq + i)), fold);
+        __m128i acgt = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(block, a), _mm_cmpeq_epi8(block, c)),
+                                    _mm_or_si128(_mm_cmpeq_epi8(block, g), _mm_cmpeq_epi8(block, t)));
+        int acgt_mask = _mm_movemask_epi8(acgt);
+        int n_mask = _mm_movemask_epi8(_mm_cmpeq_epi8(block, n));
+        if (acgt_mask == 0xFFFF) {
+            end_n_run(counts, &run);
+            counts->acgt += 16;
+        } else if (n_mask == 0xFFFF) {
+            counts->n += 16;
+            run += 16;
+        } else {
+            for (int b = 0; b < 16; b++) {
+                count_base(counts, &run, seq[i + b]);
+            }
+        }
+    }
+#endif
+    for (; i < len; i++) {
+        count_base(counts, &run, seq[i]);
+    }
+    end_n_run(counts, &run);
+}
+
+// Append one genome's QC line: base composition, CDS lengths and internal stops, and the features
+// whose location lies outside the sequence (their sequence is NULL)
+void qc_genome(FILE *fp, const char *name, Faa *faa, int cds_count, int rrn_count, int trn_count, Cds *cds_list, Rrn *rrn_list, Trn *trn_list) {
+    BaseCounts counts;
+    const char *genome = faa != NULL && faa->sequence != NULL ? faa->sequence : "";
+    classify_bases(genome, strlen(genome), &counts);
+
+    char *issues = NULL;
+    size_t issues_len = 0;
+    FILE *notes = open_memstream(&issues, &issues_len);
+    int not_mod3 = 0, stops = 0, out_of_range = 0;
+
+    for (int i = 0; i < cds_count; i++) {
+        const char *gene = cds_list[i].gene ? cds_list[i].gene : "unknown";
+        if (cds_list[i].sequence == NULL) {
+            if (cds_list[i].location != NULL) {
+                fprintf(notes, "%s%s outside the sequence (%s)", ftell(notes) ? "; " : "", gene, cds_list[i].location);
+                out_of_range++;
+            }
+            continue;
+        }
+        const char *seq = cds_list[i].sequence;
+        size_t len = strlen(seq);
+        if (len % 3 != 0) {
+            fprintf(notes, "%s%s length%%3=%zu", ftell(notes) ? "; " : "", gene, len % 3);
+            not_mod3++;
+        }
+
+        // a stop in the last complete codon ends the CDS, any earlier one is internal
+        int table;
+        const char *code = genetic_code(cds_list[i].transl_table, &table);
+        size_t codons = len / 3;
+        size_t last = (len % 3 == 0 && codons > 0) ? codons - 1 : codons;
+        size_t first_stop = 0;
+        int gene_stops = 0;
+        for (size_t k = 0; k < last; k++) {
+            int b1 = codon_base(seq[3 * k]), b2 = codon_base(seq[3 * k + 1]), b3 = codon_base(seq[3 * k + 2]);
+            if (b1 >= 0 && b2 >= 0 && b3 >= 0 && code[b1 * 16 + b2 * 4 + b3] == '*') {
+                if (gene_stops++ == 0) {
+                    first_stop = k + 1;
+                }
+            }
+        }
+        if (gene_stops > 0) {
+            fprintf(notes, "%s%s %d internal stop%s from codon %zu (table %d)", ftell(notes) ? "; " : "", gene, gene_stops, gene_stops > 1 ? "s" : "", first_stop, table);
+            stops += gene_stops;
+        }
+    }
+    for (int i = 0; i < rrn_count; i++) {
+        if (rrn_list[i].sequence == NULL && rrn_list[i].location != NULL) {
+            fprintf(notes, "%s%s outside the sequence (%s)", ftell(notes) ? "; " : "", rrn_list[i].gene ? rrn_list[i].gene : "unknown", rrn_list[i].location);
+            out_of_range++;
+        }
+    }
+    for (int i = 0; i < trn_count; i++) {
+        if (trn_list[i].sequence == NULL && trn_list[i].location != NULL) {
+            fprintf(notes, "%s%s outside the sequence (%s)", ftell(notes) ? "; " : "", trn_list[i].gene ? trn_list[i].gene : "unknown", trn_list[i].location);
+            out_of_range++;
+        }
+    }
+    fclose(notes);
+
+    fprintf(fp, "%s\t%ld\t%ld\t%ld\t%ld\t%ld\t%ld\t%ld\t%d\t%d\t%d\t%d\t%s\n", name, counts.length, counts.acgt, counts.n, counts.ambiguous,
+            counts.invalid, counts.n_runs, counts.longest_n_run, cds_count, not_mod3, stops, out_of_range, issues_len > 0 ? issues : "-");
+    free(issues);
+}
+
+void write_qc_header(FILE *fp) {
+    fprintf(fp, "Genome\tLength\tACGT\tN\tAmbiguous\tInvalid\tN_runs\tLongest_N_run\tCDS\tCDS_not_mod3\tInternal_stops\tOut_of_range\tIssues\n");
+}
+
+
+// Batch inputs run through a pipeline: one thread reads whole files ahead of the parsers, -j threads
+// parse them, and the main thread writes the results in input order. At most PIPELINE_WINDOW
+// inputs are in flight, and the reader asks the kernel for the next READAHEAD_FILES files early.
+#define PIPELINE_WINDOW 64
+#define READAHEAD_FILES 8
+
+// Define a struct to hold one slot of a bounded lock-free queue (Vyukov's MPMC ring)
+typedef struct {
+    size_t sequence;
+    void *data;
+} QueueCell;
+
+typedef struct {
+    QueueCell *cells;
+    size_t mask;
+    char pad0[64];
+    size_t enqueue_pos;
+    char pad1[64];
+    size_t dequeue_pos;
+    char pad2[64];
+    int closed;
+} BoundedQueue;
+
+void queue_init(BoundedQueue *queue, size_t capacity) {
+    memset(queue, 0, sizeof(BoundedQueue));
+    queue->cells = malloc(sizeof(QueueCell) * capacity);
+    if (queue->cells == NULL) {
+        log_print(ERROR, "Failed to allocate memory for pipeline queue");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < capacity; i++) {
+        queue->cells[i].sequence = i;
+    }
+    queue->mask = capacity - 1;
+}
+
+static int queue_try_push(BoundedQueue *queue, void *data) {
+    size_t pos = __atomic_load_n(&queue->enqueue_pos, __ATOMIC_RELAXED);
+    for (;;) {
+        QueueCell *cell = &queue->cells[pos & queue->mask];
+        size_t sequence = __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE);
+        intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&queue->enqueue_pos, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                cell->data = data;
+                __atomic_store_n(&cell->sequence, pos + 1, __ATOMIC_RELEASE);
+                return 1;
+            }
+        } else if (diff < 0) {
+            return 0;
+        } else {
+            pos = __atomic_load_n(&queue->enqueue_pos, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+static void* queue_try_pop(BoundedQueue *queue) {
+    size_t pos = __atomic_load_n(&queue->dequeue_pos, __ATOMIC_RELAXED);
+    for (;;) {
+        QueueCell *cell = &queue->cells[pos & queue->mask];
+        size_t sequence = __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE);
+        intptr_t diff = (intptr_t)sequence - (intptr_t)(pos + 1);
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&queue->dequeue_pos, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                void *data = cell->data;
+                __atomic_store_n(&cell->sequence, pos + queue->mask + 1, __ATOMIC_RELEASE);
+                return data;
+            }
+        } else if (diff < 0) {
+            return NULL;
+        } else {
+            pos = __atomic_load_n(&queue->dequeue_pos, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+// Spin briefly, then give the CPU away while a queue is full or empty
+static void queue_backoff(int *spins) {
+    if (++(*spins) < 64) {
+        return;
+    }
+    if (*spins < 256) {
+        sched_yield();
+    } else {
+        struct timespec pause = {0, 50000};
+        nanosleep(&pause, NULL);
+    }
+}
+
+void queue_push(BoundedQueue *queue, void *data) {
+    int spins = 0;
+    while (!queue_try_push(queue, data)) {
+        queue_backoff(&spins);
+    }
+}
+
+// Next item, or NULL once the queue is closed and drained
+void* queue_pop(BoundedQueue *queue) {
+    int spins = 0;
+    for (;;) {
+        void *data = queue_try_pop(queue);
+        if (data != NULL) {
+            return data;
+        }
+        if (__atomic_load_n(&queue->closed, __ATOMIC_ACQUIRE)) {
+            return queue_try_pop(queue);
+        }
+        queue_backoff(&spins);
+    }
+}
+
+void queue_close(BoundedQueue *queue) {
+    __atomic_store_n(&queue->closed, 1, __ATOMIC_RELEASE);
+}
+
+// Define a struct to hold one batch input on its way through the pipeline
+typedef struct {
+    int index;
+    char *path;
+    char *prefix;
+    int missing;
+    int cached;
+    int parsed;
+    int failed;
+    char *data;
+    size_t size;
+    uint64_t content_hash;
+    uint64_t options_hash;
+    long content_size;
+    char fragment_path[2048];
+    int cds_count;
+    int rrn_count;
+    int trn_count;
+    Cds *cds_list;
+    Faa *faa;
+    Pep *pep_list;
+    Rrn *rrn_list;
+    Trn *trn_list;
+    char *organism;
+    char *accession;
+    char *qc;
+    size_t qc_length;
+} BatchInput;
+
+// Define a struct to hold the state shared by the pipeline stages
+typedef struct {
+    char **inputs;
+    char **prefixes;            // output prefix of each input, in batch mode
+    int input_count;
+    const char *prefix;
+    const char *fasta_file;
+    const char *output_file;
+    const char *options;
+    int by_gene_flag;
+    int qc_flag;
+    int faa_flag, pep_flag, cds_flag, trn_flag, rrn_flag;
+    Cache *cache;
+    pthread_mutex_t cache_lock;
+    BatchInput slots[PIPELINE_WINDOW];
+    BoundedQueue read_queue;
+    BoundedQueue parsed_queue;
+    int written;
+} Pipeline;
+
+static void prefetch_file(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd != -1) {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+        close(fd);
+    }
+}
+
+// Whole file in one buffer, NULL if it cannot be read
+static char* read_whole_file(const char *path, size_t *size) {
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) == -1) {
+        if (fd != -1) close(fd);
+        return NULL;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    char *data = malloc(st.st_size + 1);
+    size_t done = 0;
+    while (data != NULL && done < (size_t)st.st_size) {
+        ssize_t n = read(fd, data + done, st.st_size - done);
+        if (n <= 0) {
+            free(data);
+            data = NULL;
+            break;
+        }
+        done += n;
+    }
+    close(fd);
+    if (data != NULL) {
+        data[done] = '\0';
+        *size = done;
+    }
+    return data;
+}
+
+// Can the outputs of an earlier run be kept for this input, its content hash is set either way
+static int check_cache(Pipeline *pipeline, BatchInput *item) {
+    char options[4096];
+    Cache *cache = pipeline->cache;
+
+    if (item->data != NULL) {
+        item->content_size = item->size;
+        item->content_hash = xxh64(item->data, item->size, 0);
+    } else {
+        item->content_hash = hash_file(item->path, 0, &item->content_size);
+    }
+    if (is_gff_file(item->path)) {
+        char *fasta = (pipeline->input_count == 1 && strlen(pipeline->fasta_file) > 0) ? strdup(pipeline->fasta_file) : gff_sibling_fasta(item->path);
+        if (fasta != NULL) {
+            long fasta_size;
+            item->content_hash = hash_file(fasta, item->content_hash, &fasta_size);
+            free(fasta);
+        }
+    }
+    snprintf(options, sizeof(options), "%s prefix=%s", pipeline->options, item->prefix);
+    item->options_hash = xxh64(options, strlen(options), 0);
+    cache_fragment_path(cache, item->content_hash, item->options_hash, item->fragment_path);
+
+    pthread_mutex_lock(&pipeline->cache_lock);
+    CacheEntry *entry = cache_lookup(cache, item->path);
+    int unchanged = entry != NULL && entry->size == item->content_size && entry->hash == item->content_hash && entry->options == item->options_hash;
+    char old_fragment[2048] = "";
+    if (entry != NULL && (entry->hash != item->content_hash || entry->options != item->options_hash)) {
+        cache_fragment_path(cache, entry->hash, entry->options, old_fragment);
+    }
+    pthread_mutex_unlock(&pipeline->cache_lock);
+
+    if (old_fragment[0] != '\0') {
+        unlink(old_fragment);
+    }
+    if (!unchanged) {
+        return 0;
+    }
+    if (pipeline->by_gene_flag == 1) {
+        return access(item->fragment_path, F_OK) == 0;
+    }
+    return outputs_exist(pipeline->output_file, item->prefix, pipeline->faa_flag, pipeline->pep_flag, pipeline->cds_flag, pipeline->trn_flag, pipeline->rrn_flag);
+}
+
+static void* pipeline_reader(void *arg) {
+    Pipeline *pipeline = arg;
+    for (int n = 0; n < READAHEAD_FILES && n < pipeline->input_count; n++) {
+        prefetch_file(pipeline->inputs[n]);
+    }
+
+    for (int n = 0; n < pipeline->input_count; n++) {
+        // wait until the slot's previous input has been written
+        int spins = 0;
+        while (n - __atomic_load_n(&pipeline->written, __ATOMIC_ACQUIRE) >= PIPELINE_WINDOW) {
+            queue_backoff(&spins);
+        }
+        if (n + READAHEAD_FILES < pipeline->input_count) {
+            prefetch_file(pipeline->inputs[n + READAHEAD_FILES]);
+        }
+
+        BatchInput *item = &pipeline->slots[n % PIPELINE_WINDOW];
+        memset(item, 0, sizeof(BatchInput));
+        item->index = n;
+        item->path = pipeline->inputs[n];
+        if (pipeline->input_count > 1) {
+            item->prefix = strdup(pipeline->prefixes[n]);
+        } else {
+            item->prefix = strdup(pipeline->prefix);
+        }
+
+        if (access(item->path, F_OK) == -1) {
+            item->missing = 1;
+        } else {
+            // GFF3 inputs pull in a second file and are read by their parser
+            if (!is_gff_file(item->path)) {
+                item->data = read_whole_file(item->path, &item->size);
+            }
+            // with -Q a cached input is still parsed for its QC line
+            if (pipeline->cache != NULL && check_cache(pipeline, item)) {
+                item->cached = 1;
+                if (pipeline->qc_flag == 0) {
+                    free(item->data);
+                    item->data = NULL;
+                }
+            }
+        }
+        queue_push(&pipeline->read_queue, item);
+    }
+    queue_close(&pipeline->read_queue);
+    return NULL;
+}
+
+static void parse_input(Pipeline *pipeline, BatchInput *item) {
+    int parsed;
+    if (is_gff_file(item->path)) {
+        parsed = extract_gff_annotation(&item->cds_count, &item->rrn_count, &item->trn_count, &item->cds_list, &item->faa, &item->pep_list, &item->rrn_list, &item->trn_list, &item->organism, &item->accession, item->path, pipeline->input_count > 1 ? NULL : (char *)pipeline->fasta_file);
+    } else if (item->data != NULL && item->size > 0) {
+        FILE *gbk = fmemopen(item->data, item->size, "r");
+        if (gbk == NULL) {
+            log_print(ERROR, "Failed to open genbank file '%s'", item->path);
+            parsed = -1;
+        } else {
+            parsed = read_annotation(&item->cds_count, &item->rrn_count, &item->trn_count, &item->cds_list, &item->faa, &item->pep_list, &item->rrn_list, &item->trn_list, &item->organism, &item->accession, gbk);
+        }
+    } else {
+        parsed = extract_annotation(&item->cds_count, &item->rrn_count, &item->trn_count, &item->cds_list, &item->faa, &item->pep_list, &item->rrn_list, &item->trn_list, &item->organism, &item->accession, item->path);
+    }
+    free(item->data);
+    item->data = NULL;
+    // the readers free what they had read, the writer skips the input
+    if (parsed != 0) {
+        item->failed = 1;
+        if (pipeline->qc_flag == 1) {
+            FILE *fp = open_memstream(&item->qc, &item->qc_length);
+            fprintf(fp, "%s\t-\t-\t-\t-\t-\t-\t-\t-\t-\t-\t-\tfailed to parse: %s\n", item->prefix, last_error);
+            fclose(fp);
+        }
+        return;
+    }
+    item->parsed = 1;
+
+    if (pipeline->qc_flag == 1) {
+        FILE *fp = open_memstream(&item->qc, &item->qc_length);
+        char *name = (item->accession != NULL && strlen(item->accession) > 0) ? strndup(item->accession, strcspn(item->accession, " ")) : strdup(item->prefix);
+        qc_genome(fp, name, item->faa, item->cds_count, item->rrn_count, item->trn_count, item->cds_list, item->rrn_list, item->trn_list);
+        fclose(fp);
+        free(name);
+    }
+}
+
+static void* pipeline_parser(void *arg) {
+    Pipeline *pipeline = arg;
+    BatchInput *item;
+    while ((item = queue_pop(&pipeline->read_queue)) != NULL) {
+        if (!item->missing && (!item->cached || pipeline->qc_flag == 1)) {
+            if (pipeline->input_count > 1) {
+                log_print(INFO, "[%d/%d] The genbank file: %s", item->index + 1, pipeline->input_count, item->path);
+            }
+            parse_input(pipeline, item);
+        }
+        queue_push(&pipeline->parsed_queue, item);
+    }
+    return NULL;
+}
+
+void pipeline_start(Pipeline *pipeline, pthread_t *reader, pthread_t *parsers, int threads) {
+    pthread_mutex_init(&pipeline->cache_lock, NULL);
+    queue_init(&pipeline->read_queue, PIPELINE_WINDOW);
+    queue_init(&pipeline->parsed_queue, PIPELINE_WINDOW);
+    pthread_create(reader, NULL, pipeline_reader, pipeline);
+    for (int t = 0; t < threads; t++) {
+        pthread_create(&parsers[t], NULL, pipeline_parser, pipeline);
+    }
+}
+
+// Next parsed input in input order, NULL when all have been handed out
+BatchInput* pipeline_next(Pipeline *pipeline, int *ready, int next) {
+    if (next >= pipeline->input_count) {
+        return NULL;
+    }
+    BatchInput *item;
+    while (!ready[next % PIPELINE_WINDOW]) {
+        item = queue_pop(&pipeline->parsed_queue);
+        ready[item->index % PIPELINE_WINDOW] = 1;
+    }
+    ready[next % PIPELINE_WINDOW] = 0;
+    return &pipeline->slots[next % PIPELINE_WINDOW];
+}
+
+// The written input's slot can be refilled by the reader
+void pipeline_done(Pipeline *pipeline, BatchInput *item) {
+    free(item->prefix);
+    __atomic_store_n(&pipeline->written, item->index + 1, __ATOMIC_RELEASE);
+}
+
+void pipeline_stop(Pipeline *pipeline, pthread_t reader, pthread_t *parsers, int threads) {
+    pthread_join(reader, NULL);
+    queue_close(&pipeline->parsed_queue);
+    for (int t = 0; t < threads; t++) {
+        pthread_join(parsers[t], NULL);
+    }
+    free(pipeline->read_queue.cells);
+    free(pipeline->parsed_queue.cells);
+    pthread_mutex_destroy(&pipeline->cache_lock);
+}
+
+
+// One parsed input kept by the server, identified by its path and file state
+typedef struct {
+    char *path;
+    time_t mtime;
+    off_t size;
+    int cds_count;
+    int rrn_count;
+    int trn_count;
+    Cds *cds_list;
+    Faa *faa;
+    Pep *pep_list;
+    Rrn *rrn_list;
+    Trn *trn_list;
+    char *organism;
+    char *accession;
+    unsigned long last_used;
+} ServedRecord;
+
+// The parsed inputs, evicting the least recently used one when full
+typedef struct {
+    ServedRecord *records;
+    int count;
+    int capacity;
+    unsigned long clock;
+    unsigned long hits;
+    unsigned long misses;
+} RecordCache;
+
+// A growable reply
+typedef struct {
+    char *data;
+    size_t length;
+    size_t capacity;
+} Reply;
+
+void reply_printf(Reply *reply, const char *fmt, ...) {
+    va_list args;
+    for (;;) {
+        size_t room = reply->capacity - reply->length;
+        va_start(args, fmt);
+        int needed = vsnprintf(reply->data + reply->length, room, fmt, args);
+        va_end(args);
+        if (needed >= 0 && (size_t)needed < room) {
+            reply->length += needed;
+            return;
+        }
+        reply->capacity = reply->capacity ? reply->capacity * 2 : 4096;
+        while (needed >= 0 && reply->capacity - reply->length <= (size_t)needed) {
+            reply->capacity *= 2;
+        }
+        reply->data = realloc(reply->data, reply->capacity);
+        if (reply->data == NULL) {
+            log_print(ERROR, "Failed to allocate memory for a reply");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+static void free_served_record(ServedRecord *record) {
+    free_annotation(record->cds_count, record->rrn_count, record->trn_count, record->cds_list, record->faa, record->pep_list, record->rrn_list, record->trn_list, record->organism, record->accession);
+    free(record->path);
+}
+
+// Return the parsed annotation of path, parsing it on a miss or when the file changed; NULL, with the
+// reason in last_error, if it is missing or cannot be parsed. A file that fails to parse is not kept
+ServedRecord* record_cache_get(RecordCache *cache, const char *path) {
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        snprintf(last_error, sizeof(last_error), "%s does not exist", path);
+        return NULL;
+    }
+
+    ServedRecord *slot = NULL;
+    for (int i = 0; i < cache->count; i++) {
+        if (strcmp(cache->records[i].path, path) == 0) {
+            if (cache->records[i].mtime == st.st_mtime && cache->records[i].size == st.st_size) {
+                cache->records[i].last_used = ++cache->clock;
+                cache->hits++;
+                return &cache->records[i];
+            }
+            free_served_record(&cache->records[i]);
+            slot = &cache->records[i];
+            break;
+        }
+    }
+    if (slot == NULL && cache->count < cache->capacity) {
+        slot = &cache->records[cache->count++];
+    } else if (slot == NULL) {
+        slot = &cache->records[0];
+        for (int i = 1; i < cache->count; i++) {
+            if (cache->records[i].last_used < slot->last_used) {
+                slot = &cache->records[i];
+            }
+        }
+        free_served_record(slot);
+    }
+
+    cache->misses++;
+    memset(slot, 0, sizeof(ServedRecord));
+    slot->path = strdup(path);
+    slot->mtime = st.st_mtime;
+    slot->size = st.st_size;
+    slot->last_used = ++cache->clock;
+    int parsed;
+    if (is_gff_file(path)) {
+        parsed = extract_gff_annotation(&slot->cds_count, &slot->rrn_count, &slot->trn_count, &slot->cds_list, &slot->faa, &slot->pep_list, &slot->rrn_list, &slot->trn_list, &slot->organism, &slot->accession, (char *)path, NULL);
+    } else {
+        parsed = extract_annotation(&slot->cds_count, &slot->rrn_count, &slot->trn_count, &slot->cds_list, &slot->faa, &slot->pep_list, &slot->rrn_list, &slot->trn_list, &slot->organism, &slot->accession, (char *)path);
+    }
+    if (parsed != 0) {
+        free(slot->path);
+        *slot = cache->records[--cache->count];
+        return NULL;
+    }
+    return slot;
+}
+
+static void append_served_gene(Reply *reply, const char *header, const char *gene, const char *wanted, const char *sequence) {
+    char name[MAX_GENE_LEN];
+    if (gene == NULL || sequence == NULL || sequence[0] == '\0') {
+        return;
+    }
+    normalize_gene_name(gene, name);
+    if (strcmp(wanted, "*") == 0 || strcmp(name, wanted) == 0) {
+        reply_printf(reply, ">%s %s\n%s\n", name, header, sequence);
+    }
+}
+
+// extract <cds|pep|rrn|trn|faa> <gene|*> <file>...: the matching records of every file, named like --by-gene output
+static void serve_extract(RecordCache *cache, char **fields, int field_count, Reply *reply) {
+    const char *kind = fields[1];
+    char wanted[MAX_GENE_LEN];
+    if (strcmp(fields[2], "*") == 0) {
+        strcpy(wanted, "*");
+    } else {
+        normalize_gene_name(fields[2], wanted);
+    }
+    if (strcmp(kind, "cds") != 0 && strcmp(kind, "pep") != 0 && strcmp(kind, "rrn") != 0 && strcmp(kind, "trn") != 0 && strcmp(kind, "faa") != 0) {
+        reply_printf(reply, "ERROR unknown sequence type '%s'\n", kind);
+        return;
+    }
+
+    Reply body = {NULL, 0, 0};
+    for (int f = 3; f < field_count; f++) {
+        ServedRecord *record = record_cache_get(cache, fields[f]);
+        if (record == NULL) {
+            free(body.data);
+            reply_printf(reply, "ERROR %s\n", last_error);
+            return;
+        }
+        char header[MAX_LINE_LEN];
+        if (record->accession != NULL && strlen(record->accession) > 0) {
+            snprintf(header, sizeof(header), "%.*s %s", (int)strcspn(record->accession, " "), record->accession, record->organism ? record->organism : "");
+        } else {
+            snprintf(header, sizeof(header), "%s %s", fields[f], record->organism ? record->organism : "");
+        }
+
+        if (strcmp(kind, "faa") == 0) {
+            if (record->faa != NULL && record->faa->sequence != NULL) {
+                reply_printf(&body, ">%s\n%s\n", header, record->faa->sequence);
+            }
+            continue;
+        }
+        for (int i = 0; strcmp(kind, "cds") == 0 && i < record->cds_count; i++) {
+            append_served_gene(&body, header, record->cds_list[i].gene, wanted, record->cds_list[i].sequence);
+        }
+        for (int i = 0; strcmp(kind, "pep") == 0 && i < record->cds_count; i++) {
+            append_served_gene(&body, header, record->cds_list[i].gene, wanted, record->cds_list[i].sequence != NULL ? record->pep_list[i].sequence : NULL);
+        }
+        for (int i = 0; strcmp(kind, "rrn") == 0 && i < record->rrn_count; i++) {
+            append_served_gene(&body, header, record->rrn_list[i].gene, wanted, record->rrn_list[i].sequence);
+        }
+        for (int i = 0; strcmp(kind, "trn") == 0 && i < record->trn_count; i++) {
+            append_served_gene(&body, header, record->trn_list[i].gene, wanted, record->trn_list[i].sequence);
+        }
+    }
+    reply_printf(reply, "OK\n");
+    if (body.length > 0) {
+        reply_printf(reply, "%.*s", (int)body.length, body.data);
+    }
+    free(body.data);
+}
+
+static int read_full(int fd, void *buffer, size_t length) {
+    size_t done = 0;
+    while (done < length) {
+        ssize_t n = read(fd, (char *)buffer + done, length - done);
+        if (n <= 0) {
+            return 0;
+        }
+        done += n;
+    }
+    return 1;
+}
+
+static int write_full(int fd, const void *buffer, size_t length) {
+    size_t done = 0;
+    while (done < length) {
+        ssize_t n = write(fd, (const char *)buffer + done, length - done);
+        if (n <= 0) {
+            return 0;
+        }
+        done += n;
+    }
+    return 1;
+}
+
+// Read one length-prefixed message; returns NULL at end of connection or on an oversized message
+char* read_message(int fd, uint32_t *length) {
+    unsigned char prefix[4];
+    if (!read_full(fd, prefix, 4)) {
+        return NULL;
+    }
+    *length = ((uint32_t)prefix[0] << 24) | ((uint32_t)prefix[1] << 16) | ((uint32_t)prefix[2] << 8) | prefix[3];
+    if (*length > MAX_REQUEST_LEN) {
+        return NULL;
+    }
+    char *message = malloc(*length + 1);
+    if (message == NULL || !read_full(fd, message, *length)) {
+        free(message);
+        return NULL;
+    }
+    message[*length] = '\0';
+    return message;
+}
+
+int write_message(int fd, const char *data, size_t length) {
+    unsigned char prefix[4] = {(unsigned char)(length >> 24), (unsigned char)(length >> 16), (unsigned char)(length >> 8), (unsigned char)length};
+    return write_full(fd, prefix, 4) && write_full(fd, data, length);
+}
+
+// Answer one request; returns 0 when the server should stop
+static int serve_request(RecordCache *cache, char *request, Reply *reply) {
+    char *fields[4096];
+    int field_count = 0;
+    request[strcspn(request, "\r\n")] = '\0';
+    for (char *field = strtok(request, "\t"); field != NULL && field_count < 4096; field = strtok(NULL, "\t")) {
+        fields[field_count++] = field;
+    }
+
+    if (field_count == 0) {
+        reply_printf(reply, "ERROR empty request\n");
+    } else if (strcmp(fields[0], "ping") == 0) {
+        reply_printf(reply, "OK\npong\n");
+    } else if (strcmp(fields[0], "extract") == 0 && field_count >= 4) {
+        serve_extract(cache, fields, field_count, reply);
+    } else if (strcmp(fields[0], "stats") == 0) {
+        reply_printf(reply, "OK\nrecords\t%d\ncapacity\t%d\nhits\t%lu\nmisses\t%lu\n", cache->count, cache->capacity, cache->hits, cache->misses);
+    } else if (strcmp(fields[0], "shutdown") == 0) {
+        reply_printf(reply, "OK\n");
+        return 0;
+    } else {
+        reply_printf(reply, "ERROR unknown request '%s' (ping, extract, stats, shutdown)\n", fields[0]);
+    }
+    return 1;
+}
+
+// get_seq serve --socket <path> [--cache-size N]
+int serve(int argc, char *argv[]) {
+    const char *socket_path = NULL;
+    int cache_size = DEFAULT_SERVE_CACHE;
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--socket") == 0 && i + 1 < argc) {
+            socket_path = argv[++i];
+        } else if (strcmp(argv[i], "--cache-size") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0) {
+            cache_size = atoi(argv[++i]);
+        } else {
+            log_print(ERROR, "Invalid serve option '%s'", argv[i]);
+            fprintf(stdout, "Usage: %s serve --socket <path> [--cache-size N]\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (socket_path == NULL || strlen(socket_path) >= sizeof(((struct sockaddr_un *)0)->sun_path)) {
+        log_print(ERROR, "serve needs --socket <path> (at most %d characters)", (int)sizeof(((struct sockaddr_un *)0)->sun_path) - 1);
+        exit(EXIT_FAILURE);
+    }
+
+    int server = socket(AF_UNIX, SOCK_STREAM, 0);
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, socket_path);
+    unlink(socket_path);
+    if (server < 0 || bind(server, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(server, 16) != 0) {
+        log_print(ERROR, "Failed to listen on %s", socket_path);
+        exit(EXIT_FAILURE);
+    }
+    signal(SIGPIPE, SIG_IGN);
+    log_print(INFO, "Serving on %s (cache of %d inputs)", socket_path, cache_size);
+
+    RecordCache cache = {calloc(cache_size, sizeof(ServedRecord)), 0, cache_size, 0, 0, 0};
+    int running = 1;
+    while (running) {
+        int client = accept(server, NULL, NULL);
+        if (client < 0) {
+            continue;
+        }
+        char *request;
+        uint32_t length;
+        while (running && (request = read_message(client, &length)) != NULL) {
+            Reply reply = {NULL, 0, 0};
+            running = serve_request(&cache, request, &reply);
+            int sent = write_message(client, reply.data, reply.length);
+            free(reply.data);
+            free(request);
+            if (!sent) {
+                break;
+            }
+        }
+        close(client);
+    }
+
+    close(server);
+    unlink(socket_path);
+    for (int i = 0; i < cache.count; i++) {
+        free_served_record(&cache.records[i]);
+    }
+    free(cache.records);
+    log_print(INFO, "Server stopped");
+    return 0;
+}
+
+
+int main(int argc, char *argv[]) {
+
+    if (argc > 1 && strcmp(argv[1], "serve") == 0) {
+        return serve(argc, argv);
+    }
+
+    char *genbank_file = calloc(1024, 1);
+    char *batch_file = calloc(1024, 1);
+    char *fasta_file = calloc(1024, 1);
+    char *prefix = calloc(1024, 1);
+    int all_flag = 0;
+    int faa_flag = 0;
+    int pep_flag = 0;
+    int cds_flag = 0;
+    int trn_flag = 0;
+    int rrn_flag = 0;
+    int by_gene_flag = 0;
+    int cache_flag = 0;
+    int dedup_flag = 0;
+    int qc_flag = 0;
+    int gene_order_flag = 0;
+    int threads = 1;
+    char *output_file = calloc(1024, 1);
+    
+    parse_arguments(argc, argv, genbank_file, batch_file, fasta_file, prefix, &all_flag, &faa_flag, &pep_flag, &cds_flag, &trn_flag, &rrn_flag, &by_gene_flag, &cache_flag, &dedup_flag, &qc_flag, &gene_order_flag, &threads, output_file);
+
+    char **inputs = NULL;
+    char **prefixes = NULL;
+    int input_count = 0;
+    if (strlen(batch_file) > 0) {
+        inputs = read_batch_list(batch_file, &input_count);
+        log_print(INFO, "The batch list: %s (%d genbank files)", batch_file, input_count);
+        prefixes = batch_prefixes(inputs, input_count);
+    } else {
+        if (access(genbank_file, F_OK) == -1) {
+            log_print(ERROR, "%s does not exist (gb).", genbank_file);
+            free(genbank_file);
+            free(batch_file);
+            free(fasta_file);
+            free(prefix);
+            free(output_file);
+            exit(1);
+        }
+        inputs = malloc(sizeof(char *));
+        inputs[0] = strdup(genbank_file);
+        input_count = 1;
+        log_print(INFO, "The genbank file: %s", genbank_file);
+        log_print(INFO, "The prefix: %s", prefix);
+    }
+    log_print(INFO, "The output path: %s", output_file);
+
+    if (access(output_file, F_OK) == -1) {
+        log_print(ERROR, "Output Path does not exist.");
+        exit(1);
+    }
+
+    size_t len = strlen(output_file);
+    if (len > 0 && output_file[len - 1] != '/') {
+        strcat(output_file, "/");
+    }
+
+    GenePool *pool = NULL;
+    if (by_gene_flag == 1) {
+        pool = gene_pool_create(output_file, MAX_OPEN_FILES);
+        if (dedup_flag == 1) {
+            pool->dedup = dedup_create();
+        }
+    }
+    Cache *cache = NULL;
+    if (cache_flag == 1) {
+        cache = cache_load(output_file);
+    }
+    GeneDictionary dict = {0};
+    GeneOrder *orders = NULL;
+    int order_count = 0;
+    if (gene_order_flag == 1) {
+        orders = malloc(sizeof(GeneOrder) * input_count);
+    }
+
+    // read, parse and write the inputs in a pipeline, results are written in input order
+    Pipeline *pipeline = calloc(1, sizeof(Pipeline));
+    char options[256];
+    snprintf(options, sizeof(options), "faa=%d pep=%d cds=%d trn=%d rrn=%d by_gene=%d", faa_flag, pep_flag, cds_flag, trn_flag, rrn_flag, by_gene_flag);
+    pipeline->inputs = inputs;
+    pipeline->prefixes = prefixes;
+    pipeline->input_count = input_count;
+    pipeline->prefix = prefix;
+    pipeline->fasta_file = fasta_file;
+    pipeline->output_file = output_file;
+    pipeline->options = options;
+    pipeline->by_gene_flag = by_gene_flag;
+    pipeline->qc_flag = qc_flag;
+    pipeline->faa_flag = faa_flag, pipeline->pep_flag = pep_flag, pipeline->cds_flag = cds_flag, pipeline->trn_flag = trn_flag, pipeline->rrn_flag = rrn_flag;
+    pipeline->cache = cache;
+    pthread_t reader;
+    pthread_t *parsers = malloc(sizeof(pthread_t) * threads);
+    int ready[PIPELINE_WINDOW] = {0};
+    FILE *qc_file = NULL;
+    if (qc_flag == 1) {
+        char qc_path[2048];
+        sprintf(qc_path, "%sqc_report.tsv", output_file);
+        qc_file = fopen(qc_path, "w");
+        if (qc_file == NULL) {
+            log_print(ERROR, "Failed to open %s", qc_path);
+            exit(EXIT_FAILURE);
+        }
+        write_qc_header(qc_file);
+    }
+    pipeline_start(pipeline, &reader, parsers, threads);
+
+    BatchInput *item;
+    int failed = 0;
+    for (int n = 0; (item = pipeline_next(pipeline, ready, n)) != NULL; n++) {
+        if (item->missing) {
+            log_print(WARNING, "%s does not exist (gb), skipped.", item->path);
+            pipeline_done(pipeline, item);
+            continue;
+        }
+
+        if (item->qc != NULL) {
+            fwrite(item->qc, 1, item->qc_length, qc_file);
+            free(item->qc);
+        }
+        if (item->failed) {
+            log_print(WARNING, "%s could not be parsed, skipped.", item->path);
+            failed++;
+            pipeline_done(pipeline, item);
+            continue;
+        }
+
+        // Reuse the outputs of inputs whose content and options match the manifest
+        if (item->cached) {
+            if (by_gene_flag == 0 || cache_replay_fragment(pool, item->fragment_path)) {
+                log_print(INFO, "%s unchanged, cached output reused", item->path);
+                cache->reused++;
+                if (item->parsed) {
+                    free_annotation(item->cds_count, item->rrn_count, item->trn_count, item->cds_list, item->faa, item->pep_list, item->rrn_list, item->trn_list, item->organism, item->accession);
+                }
+                pipeline_done(pipeline, item);
+                continue;
+            }
+            if (!item->parsed) {
+                parse_input(pipeline, item);
+            }
+            if (item->failed) {
+                log_print(WARNING, "%s could not be parsed, skipped.", item->path);
+                failed++;
+                pipeline_done(pipeline, item);
+                continue;
+            }
+        }
+
+        if (gene_order_flag == 1) {
+            collect_gene_order(&dict, &orders[order_count++], item->cds_count, item->rrn_count, item->trn_count, item->cds_list, item->rrn_list, item->trn_list, item->accession, item->prefix);
+        } else if (by_gene_flag == 1) {
+            if (cache != NULL) {
+                pool->record = fopen(item->fragment_path, "w");
+            }
+            write_gene_records(pool, pep_flag, cds_flag, trn_flag, rrn_flag, item->cds_count, item->rrn_count, item->trn_count, item->cds_list, item->pep_list, item->rrn_list, item->trn_list, item->organism, item->accession, item->prefix);
+            if (pool->record != NULL) {
+                fclose(pool->record);
+                pool->record = NULL;
+            }
+        } else {
+            write_annotations(output_file, item->prefix, faa_flag, pep_flag, cds_flag, trn_flag, rrn_flag, item->cds_count, item->rrn_count, item->trn_count, item->cds_list, item->faa, item->pep_list, item->rrn_list, item->trn_list);
+        }
+        if (cache != NULL) {
+            pthread_mutex_lock(&pipeline->cache_lock);
+            cache_update(cache, item->path, item->content_size, item->content_hash, item->options_hash);
+            pthread_mutex_unlock(&pipeline->cache_lock);
+            cache->processed++;
+        }
+
+        // Clean up memory
+        free_annotation(item->cds_count, item->rrn_count, item->trn_count, item->cds_list, item->faa, item->pep_list, item->rrn_list, item->trn_list, item->organism, item->accession);
+        pipeline_done(pipeline, item);
+    }
+    pipeline_stop(pipeline, reader, parsers, threads);
+    if (qc_file != NULL) {
+        fclose(qc_file);
+        log_print(INFO, "QC report saved to %sqc_report.tsv", output_file);
+    }
+    for (int n = 0; n < input_count; n++) {
+        free(inputs[n]);
+        if (prefixes) free(prefixes[n]);
+    }
+    free(prefixes);
+    free(parsers);
+    free(pipeline);
+
+    if (orders) {
+        write_gene_orders(output_file, &dict, orders, order_count, threads);
+        free_gene_orders(&dict, orders, order_count);
+    }
+    if (pool) gene_pool_close(pool);
+    if (cache) cache_save(cache);
+    free(inputs);
+    if (genbank_file) free(genbank_file);
+    if (batch_file) free(batch_file);
+    if (fasta_file) free(fasta_file);
+    if (prefix) free(prefix);
+    if (output_file) free(output_file);
+    
+    if (failed > 0) {
+        log_print(ERROR, "%d of %d inputs could not be parsed", failed, input_count);
+        return EXIT_FAILURE;
+    }
     return 0;
 
 }
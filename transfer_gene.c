@@ -12,27 +12,81 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <errno.h>
+#include <limits.h>
+#include <stddef.h>
+#include <math.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <signal.h>
+#include <time.h>
 
 #define MAX_LINE_LENGTH 1024
-#define MAX_GENE_NAME_LENGTH 100
+#define FORMAT_BLAST6 0
+#define FORMAT_PAF 1
+#define ALIGNMENT_CHUNK 4096
+#define OVERLAP_ROWS 1
+#define OVERLAP_COVERAGE 2
+#define OVERLAP_GENE_LISTS 4
+#define COLUMNAR_MAGIC "TGCOLUMN"
+#define COLUMNAR_VERSION 1
+#define COLUMNAR_BUFFER (1 << 20)
+
+// The columnar file is little-endian; big-endian hosts swap every value on its way to the file
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define COLUMNAR_SWAP 1
+#else
+#define COLUMNAR_SWAP 0
+#endif
+
+// Built-in homology search (--find): ungapped X-drop extension of exact k-mer seeds,
+// scored +1/-2 with the Karlin-Altschul parameters blastn uses for that scoring
+#define DEFAULT_KMER 15
+#define MAX_SEED_OCCURRENCES 64
+#define SEED_BUCKET_BITS 22
+#define FIND_CHUNK (1 << 20)
+#define FIND_MATCH 1
+#define FIND_MISMATCH (-2)
+#define FIND_XDROP 20
+#define FIND_LAMBDA 1.28
+#define FIND_K 0.46
+#define FIND_MAX_EVALUE 10.0
 
 // Define macros for min and max
 #define min(a, b) ((a) < (b) ? (a) : (b))
 #define max(a, b) ((a) > (b) ? (a) : (b))
 
+// Diagnostics on stderr: 0 errors and warnings only, 1 progress (-v), 2 per-alignment details (-vv)
+static int verbosity = 0;
+
+// Reason the last input of this thread failed to load, for callers that report it and carry on
+static __thread char input_error[MAX_LINE_LENGTH];
+
+// Whether input_failed prints the error itself; manifest and serve mode report it with the pair or request
+static int report_input_errors = 1;
+
 // Define a struct to hold gene information
 typedef struct {
-    char name[MAX_GENE_NAME_LENGTH];
+    char *name;
     int start;
     int end;
     int length;
     int strand;
+    char *seqid;    // sequence the gene lies on, NULL when the location file has no sequence ID column
 } Gene;
 
-// Define a struct to hold BLASTN alignment information
+// Define a struct to hold the alignment fields the overlap scan reads, in 32 bytes;
+// query and subject are IDs in the string table of the alignment set
 typedef struct {
-    char query[MAX_GENE_NAME_LENGTH];
-    char subject[MAX_GENE_NAME_LENGTH];
+    int query;
+    int subject;
     float identity;
     int alignment_length;
     int q_start;
@@ -41,25 +95,325 @@ typedef struct {
     int s_end;
 } Blastn;
 
+// Define a struct to hold the alignment columns only the filters, --hits and --merge read
+typedef struct {
+    double evalue;
+    float bitscore;
+    int mismatches;
+    int gap_opens;
+    int fragments;          // alignments merged into this one, 1 without --merge
+} AlignmentStats;
+
+// Define a struct to hold interned strings: each distinct string is stored once and named by its index
+typedef struct {
+    char **strings;
+    int count;
+    int capacity;
+    int *slots;             // open addressing over strings, -1 = empty
+    int slot_count;
+} StringTable;
+
+// Define a struct to hold a set of alignments: hot rows and cold columns side by side
+typedef struct {
+    Blastn *rows;
+    AlignmentStats *stats;
+    int count;
+    int capacity;
+    StringTable ids;        // query and subject IDs
+    int merged;             // rows are --merge blocks
+} AlignmentSet;
+
+// Define a struct to hold the alignment filters applied while reading
+typedef struct {
+    float min_identity;
+    int min_length;
+    double max_evalue;      // negative: no limit
+    float min_bitscore;
+} Filters;
+
+// Define a struct to hold the built-in homology search settings
+typedef struct {
+    int enabled;
+    char *donor_file;       // FASTA indexed for seeds, reported as the query
+    char *recipient_file;   // FASTA scanned on both strands, reported as the subject
+    char *hits_file;        // optional copy of the HSPs as BLAST tabular output
+    int k;
+} FindOptions;
+
+// Define a struct to hold a FASTA record
+typedef struct {
+    char *name;
+    char *seq;
+    int length;
+} Sequence;
+
+// Define a struct to hold one donor k-mer occurrence
+typedef struct {
+    uint64_t kmer;
+    int record;
+    int pos;
+} Seed;
+
+// Define a struct to hold the donor k-mer occurrences, sorted by k-mer,
+// with the start of each run of k-mers sharing their top bucket_bits bits
+typedef struct {
+    Seed *seeds;
+    size_t count;
+    size_t *buckets;        // 2^bucket_bits + 1 offsets into seeds
+    int bucket_bits;
+    int k;
+} SeedIndex;
+
+// Define a struct to hold how far each diagonal has been extended (open addressing, end -1 = empty)
+typedef struct {
+    long long *keys;
+    int *ends;
+    int used;
+    int capacity;
+} DiagonalTable;
+
+// Define a struct to hold an HSP of the built-in search; query and subject are record indexes until gathered
+typedef struct {
+    Blastn row;
+    AlignmentStats stats;
+} FoundHsp;
+
+// Define a struct to hold a growable list of found HSPs
+typedef struct {
+    FoundHsp *hsps;
+    int count;
+    int capacity;
+} AlignmentList;
+
+// Define a struct to hold one search window: FIND_CHUNK seed positions of one recipient strand
+typedef struct {
+    int record;
+    int strand;
+    int begin;
+} FindUnit;
+
+// Define a struct to hold the state shared by the search threads
+typedef struct {
+    Sequence *donors;
+    Sequence *recipients;
+    char **reverse;             // reverse complement of each recipient
+    SeedIndex *index;
+    double search_space;        // K * m * n for the evalue
+    FindUnit *units;
+    AlignmentList *results;     // one list per unit, gathered in unit order
+    int unit_count;
+    int next_unit;
+} FindJob;
+
+// Define a struct to hold a whole input file in memory
+typedef struct {
+    char *data;
+    size_t length;
+    int mapped;
+} InputBuffer;
+
+// Define a struct to hold the part of one gene covered by one alignment
+typedef struct {
+    int gene;
+    int lo;
+    int hi;
+    float identity;
+} CoverageSegment;
+
+// Define a struct to hold a growable list of coverage segments
+typedef struct {
+    CoverageSegment *segments;
+    int count;
+    int capacity;
+} CoverageList;
+
+// Define a struct to hold a growable list of gene indexes
+typedef struct {
+    int *genes;
+    int count;
+    int capacity;
+} GeneList;
+
+// Define a struct to hold growable output text
+typedef struct {
+    char *data;
+    size_t length;
+    size_t capacity;
+} OutputBuffer;
+
+// Define a struct to hold the gene lists of a chunk of alignments for the columnar output
+typedef struct {
+    int *counts;                // genes listed for each alignment of the chunk
+    int *genes;                 // complete genes, then partial ones, as in the HGT gene column
+    unsigned char *complete;
+    int count;
+    int capacity;
+} GeneColumn;
+
+// Define a struct to hold one entry of the columnar file's column directory
+typedef struct {
+    char name[16];
+    uint32_t type;              // COLUMN_* element type
+    uint32_t reserved;
+    uint64_t offset;            // from the start of the file, a multiple of 8
+    uint64_t count;             // elements
+} ColumnEntry;
+
+enum { COLUMN_U8 = 0, COLUMN_I32 = 1, COLUMN_U32 = 2, COLUMN_F32 = 3, COLUMN_U64 = 4 };
+
+// Define a struct to hold the buffered writer of the columnar file
+typedef struct {
+    FILE *file;
+    char *buffer;
+    size_t length;
+    uint64_t offset;
+} ColumnWriter;
+
+// Define a struct to hold one gene interval of the overlap index
+typedef struct {
+    int lo;         // min(start, end)
+    int hi;         // max(start, end)
+    int max_hi;     // largest hi in the implicit subtree rooted here
+    int gene;       // index into the genes array
+} GeneInterval;
+
+// Genes sorted by lo, with an implicit augmented interval tree laid over the sorted array
+typedef struct {
+    GeneInterval *intervals;
+    int count;
+    int root_level;
+} GeneIndex;
+
+// Define a struct to hold the gene index of one sequence
+typedef struct {
+    char *seqid;
+    GeneIndex *index;
+} SequenceGenes;
+
+// Gene indexes bucketed by sequence ID
+typedef struct {
+    SequenceGenes *sequences;
+    int count;
+    int *slots;
+    int slot_count;
+    const GeneIndex *fallback;  // used for query IDs without their own bucket
+    const GeneIndex *unnamed;   // genes without a sequence ID, NULL when every gene has one
+} GeneIndexMap;
+
+// Define a struct to hold the gene indexes a query ID is matched against
+typedef struct {
+    const GeneIndex *own;       // its own sequence's genes, or the fallback; NULL for none
+    const GeneIndex *unnamed;   // the genes without a sequence ID, when own is another index
+} QueryIndex;
+
+// Define a struct to hold a location file shared by manifest pairs, loaded by the first pair that needs it
+typedef struct {
+    char *path;
+    Gene *genes;
+    int gene_count;
+    GeneIndexMap *indexes;
+    pthread_mutex_t lock;
+    int loaded;
+    int failed;                 // the file could not be read, every pair using it fails
+    char *error;                // why, reported with each of those pairs
+} LocationEntry;
+
+// Define a struct to hold one manifest pair
+typedef struct {
+    char *name;
+    char *alignment_file;
+    int location;               // index into the location cache
+    char *output_file;          // per-pair output, NULL for the combined table only
+    OutputBuffer rows;          // rows for the combined table, held until the pairs before it are written
+    int done;
+    int failed;                 // an input could not be read or the output not written, no rows
+} ManifestPair;
+
+// Define a struct to hold the state shared by the manifest workers
+typedef struct {
+    ManifestPair *pairs;
+    int pair_count;
+    LocationEntry *locations;
+    int location_count;
+    int format;
+    const Filters *filters;
+    int merge_gap;
+    FILE *combined;             // combined table with a pair column, NULL for per-pair files only
+    pthread_mutex_t write_lock;
+    int next_pair;
+    int next_write;             // first pair not yet written to the combined table
+} ManifestJob;
+
 // Function prototypes
 void print_usage(const char *program_name);
-void parse_arguments(int argc, char *argv[], char **transfer_file, char **location_file, char **output_file);
-void read_genes(const char *filename, Gene **genes, int *gene_count);
-void read_blastn(const char *filename, Blastn **alignments, int *alignment_count);
-void find_transfer_genes(Gene *genes, int gene_count, Blastn *alignments, int alignment_count, const char *output_file);
-void free_memory(Gene *genes, Blastn *alignments);
+void parse_arguments(int argc, char *argv[], char **transfer_file, char **location_file, char **genbank_file, char **output_file, char **coverage_file, char **columnar_file, int *threads, int *format, Filters *filters, FindOptions *find, int *merge_gap, char **manifest_file);
+int open_input(const char *filename, const char *what, InputBuffer *in);
+void close_input(InputBuffer *in);
+int read_genes(const char *filename, Gene **genes, int *gene_count);
+int read_genbank_genes(const char *filename, Gene **genes, int *gene_count);
+void free_genes(Gene *genes, int gene_count);
+int intern_string(StringTable *table, const char *str, int len);
+int append_alignment(AlignmentSet *set, const Blastn *row, const AlignmentStats *stats);
+void free_alignments(AlignmentSet *set);
+void merge_alignments(AlignmentSet *set, int gap);
+int read_alignments(const char *filename, int format, const Filters *filters, AlignmentSet *alignments);
+void read_fasta(const char *filename, Sequence **records, int *record_count);
+void free_sequences(Sequence *records, int record_count);
+SeedIndex *build_seed_index(const Sequence *donors, int donor_count, int k);
+void free_seed_index(SeedIndex *index);
+void find_alignments(const char *donor_file, const char *recipient_file, int k, int threads, const Filters *filters,
+                     AlignmentSet *alignments);
+void write_alignments(const AlignmentSet *alignments, const char *filename);
+GeneIndex *build_gene_index(Gene *genes, const int *members, int member_count);
+int query_gene_index(const GeneIndex *index, int lo, int hi, int **hits, int *hits_capacity);
+int query_genes(const QueryIndex *query, int lo, int hi, int **hits, int *hits_capacity);
+void free_gene_index(GeneIndex *index);
+GeneIndexMap *build_gene_index_map(Gene *genes, int gene_count);
+QueryIndex lookup_gene_index(const GeneIndexMap *map, const char *seqid);
+void free_gene_index_map(GeneIndexMap *map);
+void buffer_printf(OutputBuffer *buffer, const char *format, ...);
+void find_transfer_genes(Gene *genes, int gene_count, const AlignmentSet *alignments, const char *output_file, const char *coverage_file, const char *columnar_file, int threads);
+void write_columnar(const char *filename, Gene *genes, int gene_count, const AlignmentSet *alignments, GeneColumn *gene_lists, int chunk_count);
+void write_gene_coverage(Gene *genes, int gene_count, CoverageList *lists, int list_count, const char *coverage_file);
+void read_manifest(const char *filename, ManifestJob *job);
+int run_manifest(const char *manifest_file, const char *output_file, int threads, int format, const Filters *filters, int merge_gap);
+void free_memory(Gene *genes, int gene_count, AlignmentSet *alignments);
 
 void print_usage(const char *program_name) {
     fprintf(stderr, "Usage: %s -t <blastn_file> -l <location_file> -o <output_file>\n", program_name);
+    fprintf(stderr, "       %s -t <blastn_file> -g <genbank_file> -o <output_file>\n", program_name);
+    fprintf(stderr, "       %s --find --donor <fasta> --recipient <fasta> -l <location_file> -o <output_file>\n", program_name);
+    fprintf(stderr, "       %s --manifest <pairs.tsv> [-o <combined_output>] [-j <threads>]\n", program_name);
+    fprintf(stderr, "       %s serve --socket <path> [--cache-size N] [-v]\n", program_name);
     fprintf(stderr, "Required options:\n");
-    fprintf(stderr, "   -t, --transfer  Blastn file\n");
-    fprintf(stderr, "   -l, --location  Gene location file\n");
+    fprintf(stderr, "   -t, --transfer  Alignment file (BLASTN -outfmt 6, or PAF with -F paf)\n");
+    fprintf(stderr, "   -l, --location  Gene location file (name start end length strand [seqid])\n");
+    fprintf(stderr, "   -g, --genbank   Genbank file to take CDS/tRNA/rRNA locations from (instead of -l)\n");
     fprintf(stderr, "   -o, --output    Output file\n");
     fprintf(stderr, "Optional options:\n");
+    fprintf(stderr, "   -c, --coverage  Per-gene coverage report file\n");
+    fprintf(stderr, "   --columnar      Also (or, without -o, only) write the output table in binary columnar form\n");
+    fprintf(stderr, "   -j, --threads   Number of threads (default: 1)\n");
+    fprintf(stderr, "   -F, --format    Alignment format: blast6 or paf (default: blast6)\n");
+    fprintf(stderr, "   --min-identity  Skip alignments below this percent identity\n");
+    fprintf(stderr, "   --min-length    Skip alignments shorter than this\n");
+    fprintf(stderr, "   --max-evalue    Skip alignments above this evalue\n");
+    fprintf(stderr, "   --min-bitscore  Skip alignments below this bitscore\n");
+    fprintf(stderr, "   --merge [gap]   Merge overlapping or near-duplicate alignments (within gap bases, default: 0)\n");
+    fprintf(stderr, "Homology search (instead of -t):\n");
+    fprintf(stderr, "   --find          Find the alignments with the built-in k-mer seed-and-extend search\n");
+    fprintf(stderr, "   --donor         Donor FASTA (e.g. plastome), reported as the query\n");
+    fprintf(stderr, "   --recipient     Recipient FASTA (e.g. mitogenome), searched on both strands\n");
+    fprintf(stderr, "   -k, --kmer      Seed length, 8-32 (default: %d)\n", DEFAULT_KMER);
+    fprintf(stderr, "   --hits          Also write the alignments found as BLAST tabular output\n");
+    fprintf(stderr, "Batch mode (instead of -t and -l/-g):\n");
+    fprintf(stderr, "   --manifest      Pairs file: pair_name alignment_file location_file [output_file] per line;\n");
+    fprintf(stderr, "                   -o writes all pairs to one table with a Pair column, -j runs pairs in parallel\n");
+    fprintf(stderr, "   -v, --verbose   Report progress on stderr; -vv also lists every partial gene overlap\n");
     fprintf(stderr, "   -h, --help      Display this help message\n");
 }
 
-void parse_arguments(int argc, char *argv[], char **transfer_file, char **location_file, char **output_file) {
+void parse_arguments(int argc, char *argv[], char **transfer_file, char **location_file, char **genbank_file, char **output_file, char **coverage_file, char **columnar_file, int *threads, int *format, Filters *filters, FindOptions *find, int *merge_gap, char **manifest_file) {
     int i;
     for (i = 1; i < argc; i++) {
         if (strcmp(argv[i], "-t") == 0 || strcmp(argv[i], "--transfer") == 0) {
@@ -78,6 +432,14 @@ void parse_arguments(int argc, char *argv[], char **transfer_file, char **locati
                 print_usage(argv[0]);
                 exit(EXIT_FAILURE);
             }
+        } else if (strcmp(argv[i], "-g") == 0 || strcmp(argv[i], "--genbank") == 0) {
+            if (i + 1 < argc) {
+                *genbank_file = argv[++i];
+            } else {
+                fprintf(stderr, "Error: Missing genbank file argument\n");
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
         } else if (strcmp(argv[i], "-o") == 0 || strcmp(argv[i], "--output") == 0) {
             if (i + 1 < argc) {
                 *output_file = argv[++i];
@@ -86,6 +448,100 @@ void parse_arguments(int argc, char *argv[], char **transfer_file, char **locati
                 print_usage(argv[0]);
                 exit(EXIT_FAILURE);
             }
+        } else if (strcmp(argv[i], "-c") == 0 || strcmp(argv[i], "--coverage") == 0) {
+            if (i + 1 < argc) {
+                *coverage_file = argv[++i];
+            } else {
+                fprintf(stderr, "Error: Missing coverage file argument\n");
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+        } else if (strcmp(argv[i], "--columnar") == 0) {
+            if (i + 1 < argc) {
+                *columnar_file = argv[++i];
+            } else {
+                fprintf(stderr, "Error: Missing columnar file argument\n");
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+        } else if (strcmp(argv[i], "-j") == 0 || strcmp(argv[i], "--threads") == 0) {
+            if (i + 1 < argc && atoi(argv[i + 1]) > 0) {
+                *threads = atoi(argv[++i]);
+            } else {
+                fprintf(stderr, "Error: Missing or invalid thread count\n");
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+        } else if (strcmp(argv[i], "-F") == 0 || strcmp(argv[i], "--format") == 0) {
+            if (i + 1 < argc && strcmp(argv[i + 1], "blast6") == 0) {
+                *format = FORMAT_BLAST6;
+            } else if (i + 1 < argc && strcmp(argv[i + 1], "paf") == 0) {
+                *format = FORMAT_PAF;
+            } else {
+                fprintf(stderr, "Error: Missing or invalid alignment format (blast6 or paf)\n");
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            i++;
+        } else if (strcmp(argv[i], "--find") == 0) {
+            find->enabled = 1;
+        } else if (strcmp(argv[i], "--donor") == 0 || strcmp(argv[i], "--recipient") == 0 || strcmp(argv[i], "--hits") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: Missing file argument for %s\n", argv[i]);
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            if (strcmp(argv[i], "--donor") == 0) {
+                find->donor_file = argv[++i];
+            } else if (strcmp(argv[i], "--recipient") == 0) {
+                find->recipient_file = argv[++i];
+            } else {
+                find->hits_file = argv[++i];
+            }
+        } else if (strcmp(argv[i], "-k") == 0 || strcmp(argv[i], "--kmer") == 0) {
+            if (i + 1 < argc && atoi(argv[i + 1]) >= 8 && atoi(argv[i + 1]) <= 32) {
+                find->k = atoi(argv[++i]);
+            } else {
+                fprintf(stderr, "Error: Missing or invalid seed length (8-32)\n");
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+        } else if (strcmp(argv[i], "--min-identity") == 0 || strcmp(argv[i], "--min-length") == 0 ||
+                   strcmp(argv[i], "--max-evalue") == 0 || strcmp(argv[i], "--min-bitscore") == 0) {
+            char *end = NULL;
+            double value = i + 1 < argc ? strtod(argv[i + 1], &end) : 0.0;
+            if (end == NULL || end == argv[i + 1] || *end != '\0' || value < 0) {
+                fprintf(stderr, "Error: Missing or invalid value for %s\n", argv[i]);
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            if (strcmp(argv[i], "--min-identity") == 0) {
+                filters->min_identity = (float)value;
+            } else if (strcmp(argv[i], "--min-length") == 0) {
+                filters->min_length = (int)value;
+            } else if (strcmp(argv[i], "--max-evalue") == 0) {
+                filters->max_evalue = value;
+            } else {
+                filters->min_bitscore = (float)value;
+            }
+            i++;
+        } else if (strcmp(argv[i], "--manifest") == 0) {
+            if (i + 1 < argc) {
+                *manifest_file = argv[++i];
+            } else {
+                fprintf(stderr, "Error: Missing manifest file argument\n");
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+        } else if (strcmp(argv[i], "--merge") == 0) {
+            *merge_gap = 0;
+            if (i + 1 < argc && argv[i + 1][0] >= '0' && argv[i + 1][0] <= '9') {
+                *merge_gap = atoi(argv[++i]);
+            }
+        } else if (strcmp(argv[i], "-v") == 0 || strcmp(argv[i], "--verbose") == 0) {
+            verbosity++;
+        } else if (strcmp(argv[i], "-vv") == 0) {
+            verbosity += 2;
         } else if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
             print_usage(argv[0]);
             exit(EXIT_SUCCESS);
@@ -96,167 +552,2799 @@ void parse_arguments(int argc, char *argv[], char **transfer_file, char **locati
         }
     }
 
-    if (*transfer_file == NULL || *location_file == NULL || *output_file == NULL) {
+    if (*manifest_file != NULL) {
+        if (find->enabled || *coverage_file != NULL || *columnar_file != NULL) {
+            fprintf(stderr, "Error: --manifest cannot be combined with --find, -c or --columnar\n");
+            print_usage(argv[0]);
+            exit(EXIT_FAILURE);
+        }
+        return;
+    }
+    if (find->enabled && (find->donor_file == NULL || find->recipient_file == NULL)) {
+        fprintf(stderr, "Error: --find needs --donor and --recipient FASTA files\n");
+        print_usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    if ((*transfer_file == NULL && !find->enabled) || (*location_file == NULL && *genbank_file == NULL) ||
+        (*output_file == NULL && *columnar_file == NULL)) {
         fprintf(stderr, "Error: Please provide all required arguments\n");
         print_usage(argv[0]);
         exit(EXIT_FAILURE);
     }
 }
 
-void read_genes(const char *filename, Gene **genes, int *gene_count) {
-    FILE *file = fopen(filename, "r");
-    if (file == NULL) {
-        fprintf(stderr, "Error opening gene file: %s\n", filename);
-        exit(EXIT_FAILURE);
+// Keep an input error in input_error and print it unless the caller reports it; returns -1 for the
+// reader to pass on
+static int input_failed(const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    vsnprintf(input_error, sizeof(input_error), format, args);
+    va_end(args);
+    if (report_input_errors) {
+        fprintf(stderr, "Error %s\n", input_error);
     }
+    return -1;
+}
 
-    char line[MAX_LINE_LENGTH];
-    *gene_count = 0;
+// Load a whole input file: regular files are mapped, anything else (e.g. a pipe) is read into memory.
+// Returns -1 when the file cannot be opened or loaded
+int open_input(const char *filename, const char *what, InputBuffer *in) {
+    int fd = open(filename, O_RDONLY);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) == -1) {
+        if (fd != -1) close(fd);
+        return input_failed("opening %s file: %s", what, filename);
+    }
+
+    in->data = NULL;
+    in->length = 0;
+    in->mapped = 0;
+    if (S_ISREG(st.st_mode)) {
+        if (st.st_size > 0) {
+            in->data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (in->data == MAP_FAILED) {
+                close(fd);
+                return input_failed("mapping %s file: %s", what, filename);
+            }
+            madvise(in->data, st.st_size, MADV_SEQUENTIAL);
+            in->length = st.st_size;
+            in->mapped = 1;
+        }
+    } else {
+        size_t capacity = 1 << 20;
+        ssize_t got = 0;
+        in->data = (char *)malloc(capacity);
+        while (in->data != NULL) {
+            got = read(fd, in->data + in->length, capacity - in->length);
+            if (got < 0 && errno == EINTR) {
+                continue;
+            }
+            if (got <= 0) {
+                break;
+            }
+            in->length += got;
+            if (in->length == capacity) {
+                char *grown = (char *)realloc(in->data, capacity * 2);
+                if (grown == NULL) {
+                    free(in->data);
+                }
+                in->data = grown;
+                capacity *= 2;
+            }
+        }
+        if (in->data == NULL) {
+            close(fd);
+            return input_failed("allocating memory for %s file", what);
+        }
+        if (got < 0) {
+            free(in->data);
+            in->data = NULL;
+            close(fd);
+            return input_failed("reading %s file: %s", what, filename);
+        }
+    }
+    close(fd);
+    return 0;
+}
+
+void close_input(InputBuffer *in) {
+    if (in->mapped) {
+        munmap(in->data, in->length);
+    } else {
+        free(in->data);
+    }
+}
+
+// Split [line, end) into tab/space separated fields, returns how many were found (at most max_fields)
+static int split_fields(const char *line, const char *end, const char **fields, int *lengths, int max_fields) {
+    int n = 0;
+    const char *p = line;
+    while (n < max_fields) {
+        while (p < end && (*p == '\t' || *p == ' ')) p++;
+        if (p >= end) break;
+        fields[n] = p;
+        while (p < end && *p != '\t' && *p != ' ') p++;
+        lengths[n] = (int)(p - fields[n]);
+        n++;
+    }
+    return n;
+}
+
+static int parse_int(const char *s, int len) {
+    int i = 0, sign = 1, value = 0;
+    if (i < len && (s[i] == '-' || s[i] == '+')) {
+        sign = s[i] == '-' ? -1 : 1;
+        i++;
+    }
+    for (; i < len && s[i] >= '0' && s[i] <= '9'; i++) {
+        value = value * 10 + (s[i] - '0');
+    }
+    return sign * value;
+}
 
-    while (fgets(line, sizeof(line), file)) {
-        if (line[0] != '#' && strncmp(line, "Gene", 4) && strlen(line) > 1) {
-            (*gene_count)++;
+static double parse_double(const char *s, int len) {
+    int i = 0, sign = 1, exponent = 0, scale = 0;
+    double value = 0.0;
+    if (i < len && (s[i] == '-' || s[i] == '+')) {
+        sign = s[i] == '-' ? -1 : 1;
+        i++;
+    }
+    for (; i < len && s[i] >= '0' && s[i] <= '9'; i++) {
+        value = value * 10.0 + (s[i] - '0');
+    }
+    if (i < len && s[i] == '.') {
+        for (i++; i < len && s[i] >= '0' && s[i] <= '9'; i++) {
+            value = value * 10.0 + (s[i] - '0');
+            scale--;
         }
     }
+    if (i < len && (s[i] == 'e' || s[i] == 'E')) {
+        exponent = parse_int(s + i + 1, len - i - 1);
+    }
+    scale += exponent;
+    if (scale < 0) {
+        double divisor = 1.0;
+        for (; scale < 0; scale++) divisor *= 10.0;
+        value /= divisor;
+    } else {
+        for (; scale > 0; scale--) value *= 10.0;
+    }
+    return sign * value;
+}
+
+// Return a NUL-terminated copy of field[0, length), NULL when out of memory
+static char *copy_field(const char *field, int length) {
+    char *copy = (char *)malloc(length + 1);
+    if (copy == NULL) {
+        input_failed("allocating memory for field");
+        return NULL;
+    }
+    memcpy(copy, field, length);
+    copy[length] = '\0';
+    return copy;
+}
 
-    rewind(file);
+// Read a gene location file; returns -1, with nothing left allocated, when it cannot be loaded
+int read_genes(const char *filename, Gene **genes, int *gene_count) {
+    InputBuffer in;
+    *genes = NULL;
+    *gene_count = 0;
+    if (open_input(filename, "gene", &in) != 0) {
+        return -1;
+    }
 
-    *genes = (Gene *)malloc((*gene_count) * sizeof(Gene));
+    int capacity = 256;
+    *genes = (Gene *)malloc(capacity * sizeof(Gene));
     if (*genes == NULL) {
-        fprintf(stderr, "Error allocating memory for genes\n");
-        fclose(file);
-        exit(EXIT_FAILURE);
+        close_input(&in);
+        return input_failed("allocating memory for genes");
     }
 
-    int i = 0;
-    while (fgets(line, sizeof(line), file)) {
-        if (line[0] != '#' && strncmp(line, "Gene", 4) && strlen(line) > 1) {
-            sscanf(
-                line, "%s %d %d %d %d", 
-                (*genes)[i].name, 
-                &(*genes)[i].start, 
-                &(*genes)[i].end, 
-                &(*genes)[i].length, 
-                &(*genes)[i].strand
-            );
-            i++;
+    const char *p = in.data, *end = in.data + in.length;
+    while (p < end) {
+        const char *eol = memchr(p, '\n', end - p);
+        if (eol == NULL) eol = end;
+        const char *line_end = (eol > p && eol[-1] == '\r') ? eol - 1 : eol;
+
+        const char *fields[6];
+        int lengths[6] = {0};
+        if (p[0] != '#' && strncmp(p, "Gene", min(4, (int)(end - p))) && split_fields(p, line_end, fields, lengths, 6) >= 3) {
+            if (*gene_count == capacity) {
+                Gene *grown = (Gene *)realloc(*genes, capacity * 2 * sizeof(Gene));
+                if (grown == NULL) {
+                    input_failed("allocating memory for genes");
+                    break;
+                }
+                *genes = grown;
+                capacity *= 2;
+            }
+            Gene *gene = &(*genes)[(*gene_count)++];
+            gene->name = copy_field(fields[0], lengths[0]);
+            gene->start = parse_int(fields[1], lengths[1]);
+            gene->end = parse_int(fields[2], lengths[2]);
+            gene->length = lengths[3] ? parse_int(fields[3], lengths[3]) : 0;
+            gene->strand = lengths[4] ? parse_int(fields[4], lengths[4]) : 0;
+            gene->seqid = lengths[5] ? copy_field(fields[5], lengths[5]) : NULL;
+            if (gene->name == NULL || (lengths[5] && gene->seqid == NULL)) {
+                break;
+            }
         }
+        p = eol + 1;
     }
 
-    fclose(file);
+    close_input(&in);
+    if (p < end) {
+        free_genes(*genes, *gene_count);
+        *genes = NULL;
+        *gene_count = 0;
+        return -1;
+    }
+    return 0;
 }
 
-void read_blastn(const char *filename, Blastn **alignments, int *alignment_count) {
-    FILE *file = fopen(filename, "r");
-    if (file == NULL) {
-        fprintf(stderr, "Error opening BLASTN file: %s\n", filename);
-        exit(EXIT_FAILURE);
+void free_genes(Gene *genes, int gene_count) {
+    for (int i = 0; i < gene_count; i++) {
+        free(genes[i].name);
+        free(genes[i].seqid);
     }
+    free(genes);
+}
 
-    char line[MAX_LINE_LENGTH];
-    *alignment_count = 0;
+static int append_gene(Gene **genes, int *gene_count, int *capacity, const char *name, int lo, int hi, int strand, const char *seqid) {
+    if (*gene_count == *capacity) {
+        int grown_capacity = *capacity ? *capacity * 2 : 256;
+        Gene *grown = (Gene *)realloc(*genes, grown_capacity * sizeof(Gene));
+        if (grown == NULL) {
+            return input_failed("allocating memory for genes");
+        }
+        *genes = grown;
+        *capacity = grown_capacity;
+    }
+    Gene *gene = &(*genes)[(*gene_count)++];
+    gene->name = copy_field(name, strlen(name));
+    gene->start = lo;
+    gene->end = hi;
+    gene->length = hi - lo + 1;
+    gene->strand = strand;
+    gene->seqid = seqid ? copy_field(seqid, strlen(seqid)) : NULL;
+    return gene->name == NULL || (seqid && gene->seqid == NULL) ? -1 : 0;
+}
 
-    while (fgets(line, sizeof(line), file)) {
-        if (line[0] != '#' && strlen(line) > 1) {
-            (*alignment_count)++;
+// Split a genbank location (join/order/complement, <, >) into intervals in transcription order;
+// returns -1 when out of memory or nested deeper than complement_depth holds
+static int parse_location(const char *location, int **los, int **his, int **strands, int *capacity) {
+    int count = 0, depth = 0, complement_depth[64] = {0}, outer_complement = 0;
+    const char *p = location;
+    while (*p) {
+        if ((strncmp(p, "complement(", 11) == 0 || strncmp(p, "join(", 5) == 0 || strncmp(p, "order(", 6) == 0) && depth >= 63) {
+            return input_failed("feature location nested too deeply: %.60s", location);
+        }
+        if (strncmp(p, "complement(", 11) == 0) {
+            if (depth == 0) outer_complement = 1;
+            complement_depth[depth + 1] = complement_depth[depth] + 1;
+            depth++;
+            p += 11;
+        } else if (strncmp(p, "join(", 5) == 0 || strncmp(p, "order(", 6) == 0) {
+            complement_depth[depth + 1] = complement_depth[depth];
+            depth++;
+            p += *p == 'j' ? 5 : 6;
+        } else if (*p == ')') {
+            if (depth > 0) depth--;
+            p++;
+        } else if (*p == '<' || *p == '>' || (*p >= '0' && *p <= '9')) {
+            while (*p == '<' || *p == '>') p++;
+            int lo = (int)strtol(p, (char **)&p, 10), hi = lo;
+            if (p[0] == '.' && p[1] == '.') {
+                p += 2;
+                while (*p == '<' || *p == '>') p++;
+                hi = (int)strtol(p, (char **)&p, 10);
+            } else if (*p == '^') {
+                // a site between two bases
+                hi = (int)strtol(p + 1, (char **)&p, 10);
+            }
+            if (count == *capacity) {
+                *capacity = *capacity ? *capacity * 2 : 16;
+                int *grown_los = (int *)realloc(*los, *capacity * sizeof(int));
+                if (grown_los != NULL) *los = grown_los;
+                int *grown_his = (int *)realloc(*his, *capacity * sizeof(int));
+                if (grown_his != NULL) *his = grown_his;
+                int *grown_strands = (int *)realloc(*strands, *capacity * sizeof(int));
+                if (grown_strands != NULL) *strands = grown_strands;
+                if (grown_los == NULL || grown_his == NULL || grown_strands == NULL) {
+                    return input_failed("allocating memory for feature location");
+                }
+            }
+            (*los)[count] = min(lo, hi);
+            (*his)[count] = max(lo, hi);
+            (*strands)[count] = complement_depth[depth] % 2 ? -1 : 1;
+            count++;
+        } else if (*p == ',' || *p == ' ') {
+            p++;
+        } else {
+            // remote reference (e.g. J00194.1:100..202): not on this sequence
+            while (*p && *p != ',' && *p != ')') p++;
         }
     }
 
-    rewind(file);
+    // complement(join(a,b)) is transcribed from the last interval to the first
+    if (outer_complement) {
+        for (int i = 0, j = count - 1; i < j; i++, j--) {
+            int t;
+            t = (*los)[i], (*los)[i] = (*los)[j], (*los)[j] = t;
+            t = (*his)[i], (*his)[i] = (*his)[j], (*his)[j] = t;
+            t = (*strands)[i], (*strands)[i] = (*strands)[j], (*strands)[j] = t;
+        }
+    }
+    return count;
+}
 
-    *alignments = (Blastn *)malloc((*alignment_count) * sizeof(Blastn));
-    if (*alignments == NULL) {
-        fprintf(stderr, "Error allocating memory for alignments\n");
-        fclose(file);
-        exit(EXIT_FAILURE);
+// Build the gene list from the CDS/tRNA/rRNA features of a genbank file, laid out as get_seq reads it:
+// feature keys at column 5, locations and qualifiers at column 21. Joined features give one entry per exon.
+// Returns -1, with nothing left allocated, when the file cannot be loaded
+int read_genbank_genes(const char *filename, Gene **genes, int *gene_count) {
+    InputBuffer in;
+    *genes = NULL;
+    *gene_count = 0;
+    if (open_input(filename, "genbank", &in) != 0) {
+        return -1;
     }
 
-    int i = 0;
-    while (fgets(line, sizeof(line), file)) {
-        if (line[0] != '#' && strlen(line) > 1) {
-            sscanf(
-                line, "%s %s %f %d %*d %*d %d %d %d %d", 
-                (*alignments)[i].query, 
-                (*alignments)[i].subject, 
-                &(*alignments)[i].identity, 
-                &(*alignments)[i].alignment_length, 
-                &(*alignments)[i].q_start, 
-                &(*alignments)[i].q_end, 
-                &(*alignments)[i].s_start, 
-                &(*alignments)[i].s_end
-            );
-            i++;
+    int capacity = 0, failed = 0;
+
+    char seqid[MAX_LINE_LENGTH] = "";
+    char key[32] = "";
+    char name[MAX_LINE_LENGTH] = "";
+    OutputBuffer location = {NULL, 0, 0};
+    int in_features = 0, in_location = 0;
+    int *los = NULL, *his = NULL, *strands = NULL, interval_capacity = 0;
+
+    const char *p = in.data, *end = in.data + in.length;
+    while (p <= end) {
+        const char *eol = p < end ? memchr(p, '\n', end - p) : NULL;
+        if (eol == NULL) eol = end;
+        const char *line_end = (eol > p && eol[-1] == '\r') ? eol - 1 : eol;
+        int len = (int)(line_end - p);
+        int new_feature = in_features && len > 21 && strncmp(p, "     ", 5) == 0 && p[5] != ' ';
+
+        // a feature ends where the next one (or the FEATURES table) starts
+        if (key[0] != '\0' && (new_feature || !in_features || len == 0 || p[0] != ' ' || p >= end)) {
+            if (strcmp(key, "CDS") == 0 || strcmp(key, "tRNA") == 0 || strcmp(key, "rRNA") == 0) {
+                buffer_printf(&location, "");
+                int count = parse_location(location.data, &los, &his, &strands, &interval_capacity);
+                failed = count < 0;
+                for (int i = 0; i < count && !failed; i++) {
+                    char exon_name[MAX_LINE_LENGTH + 16];
+                    if (count > 1) {
+                        snprintf(exon_name, sizeof(exon_name), "%s-exon%d", name[0] ? name : key, i + 1);
+                    } else {
+                        snprintf(exon_name, sizeof(exon_name), "%s", name[0] ? name : key);
+                    }
+                    failed = append_gene(genes, gene_count, &capacity, exon_name, los[i], his[i], strands[i], seqid[0] ? seqid : NULL) != 0;
+                }
+            }
+            key[0] = '\0';
+        }
+        if (p >= end || failed) {
+            break;
+        }
+
+        if (len >= 5 && strncmp(p, "LOCUS", 5) == 0) {
+            sscanf(p + 5, "%1023s", seqid);
+        } else if (len >= 9 && strncmp(p, "ACCESSION", 9) == 0 && in_features == 0) {
+            sscanf(p + 9, "%1023s", seqid);
+        } else if (len >= 7 && strncmp(p, "VERSION", 7) == 0 && in_features == 0) {
+            sscanf(p + 7, "%1023s", seqid);
+        } else if (len >= 8 && strncmp(p, "FEATURES", 8) == 0) {
+            in_features = 1;
+        } else if (len > 0 && p[0] != ' ') {
+            // ORIGIN, CONTIG, // ...
+            in_features = 0;
+        } else if (new_feature) {
+            int key_len = 0;
+            while (5 + key_len < len && p[5 + key_len] != ' ' && key_len < (int)sizeof(key) - 1) {
+                key[key_len] = p[5 + key_len];
+                key_len++;
+            }
+            key[key_len] = '\0';
+            name[0] = '\0';
+            location.length = 0;
+            buffer_printf(&location, "%.*s", len - 21, p + 21);
+            in_location = 1;
+        } else if (key[0] != '\0' && len > 21) {
+            const char *text = p + 21;
+            if (text[0] == '/') {
+                in_location = 0;
+                if (strncmp(text, "/gene=\"", 7) == 0 || (name[0] == '\0' && strncmp(text, "/product=\"", 10) == 0)) {
+                    const char *value = strchr(text, '"') + 1;
+                    int value_len = (int)(line_end - value);
+                    if (value_len > 0 && value[value_len - 1] == '"') value_len--;
+                    snprintf(name, sizeof(name), "%.*s", value_len, value);
+                }
+            } else if (in_location) {
+                buffer_printf(&location, "%.*s", len - 21, text);
+            }
         }
+        p = eol + 1;
     }
 
-    fclose(file);
+    free(location.data);
+    free(los);
+    free(his);
+    free(strands);
+    close_input(&in);
+    if (failed) {
+        free_genes(*genes, *gene_count);
+        *genes = NULL;
+        *gene_count = 0;
+        return -1;
+    }
+    return 0;
 }
 
-void find_transfer_genes(Gene *genes, int gene_count, Blastn *alignments, int alignment_count, const char *output_file) {
-    FILE *file = fopen(output_file, "w");
-    if (file == NULL) {
-        fprintf(stderr, "Error opening output file: %s\n", output_file);
-        exit(EXIT_FAILURE);
+// Parse one BLAST tabular (-outfmt 6) row; returns 0 when the row has fewer than 10 columns
+static int parse_blast6_row(const char *line, const char *line_end, Blastn *hsp, AlignmentStats *stats, const char **query, int *query_len, const char **subject, int *subject_len) {
+    const char *fields[12];
+    int lengths[12] = {0};
+    int n = split_fields(line, line_end, fields, lengths, 12);
+    if (n < 10) {
+        return 0;
     }
-    fprintf(file, "No\tCp\tMt\tIdentity\tlength\tq.start\tq.end\ts.start\ts.end\tHGT gene\n");
-    for (int j = 0; j < alignment_count; j++) {
-        char hgt_gene[MAX_GENE_NAME_LENGTH * 100] = ""; // Increase the buffer size as needed
-        char  incomplete_gene[MAX_GENE_NAME_LENGTH * 100] = ""; // Increase the buffer size as needed
-        for (int i = 0; i < gene_count; i++) {
-            if (min(genes[i].start, genes[i].end) >= min(alignments[j].q_start, alignments[j].q_end) &&
-                max(genes[i].start, genes[i].end) <= max(alignments[j].q_start, alignments[j].q_end)) {
-                strcat(hgt_gene, genes[i].name);
-                strcat(hgt_gene, "* ");
-            }else if (genes[i].start > min(alignments[j].q_start, alignments[j].q_end) && genes[i].start < max(alignments[j].q_start, alignments[j].q_end) ||
-                genes[i].end > min(alignments[j].q_start, alignments[j].q_end) && genes[i].end < max(alignments[j].q_start, alignments[j].q_end)) {
-                    printf("ceshi\n");
-                    printf("%s %d %d %d %d\n",genes[i].name, genes[i].start, genes[i].end, alignments[j].q_start, alignments[j].q_end);
-                    strcat(incomplete_gene, genes[i].name);
-                    strcat(incomplete_gene, " ");
-            }
-            
-            
-        }
-        fprintf(file, "%d\t%s\t%s\t%.2f\t%d\t%d\t%d\t%d\t%d\t%s%s\n",
-                j + 1,
-                "Cp",
-                "Mt",
-                alignments[j].identity,
-                alignments[j].alignment_length,
-                alignments[j].q_start,
-                alignments[j].q_end,
-                alignments[j].s_start,
-                alignments[j].s_end,
-                hgt_gene,
-                incomplete_gene);
+    *query = fields[0];
+    *query_len = lengths[0];
+    *subject = fields[1];
+    *subject_len = lengths[1];
+    hsp->identity = (float)parse_double(fields[2], lengths[2]);
+    hsp->alignment_length = parse_int(fields[3], lengths[3]);
+    stats->mismatches = parse_int(fields[4], lengths[4]);
+    stats->gap_opens = parse_int(fields[5], lengths[5]);
+    stats->fragments = 1;
+    hsp->q_start = parse_int(fields[6], lengths[6]);
+    hsp->q_end = parse_int(fields[7], lengths[7]);
+    hsp->s_start = parse_int(fields[8], lengths[8]);
+    hsp->s_end = parse_int(fields[9], lengths[9]);
+    stats->evalue = n > 10 ? parse_double(fields[10], lengths[10]) : 0.0;
+    stats->bitscore = n > 11 ? (float)parse_double(fields[11], lengths[11]) : 0.0f;
+    return 1;
+}
+
+// Parse one PAF (minimap2) row onto BLAST conventions: 1-based inclusive coordinates,
+// s_start > s_end on the minus strand, identity = residue matches / block length.
+// Returns 0 when the row has fewer than the 12 mandatory columns
+static int parse_paf_row(const char *line, const char *line_end, Blastn *hsp, AlignmentStats *stats, const char **query, int *query_len, const char **subject, int *subject_len) {
+    const char *fields[32];
+    int lengths[32] = {0};
+    int n = split_fields(line, line_end, fields, lengths, 32);
+    if (n < 12) {
+        return 0;
     }
+    int q_start = parse_int(fields[2], lengths[2]);
+    int q_end = parse_int(fields[3], lengths[3]);
+    int t_start = parse_int(fields[7], lengths[7]);
+    int t_end = parse_int(fields[8], lengths[8]);
+    int matches = parse_int(fields[9], lengths[9]);
+    int block_length = parse_int(fields[10], lengths[10]);
 
-    fclose(file);
+    *query = fields[0];
+    *query_len = lengths[0];
+    *subject = fields[5];
+    *subject_len = lengths[5];
+    hsp->identity = block_length > 0 ? (float)(100.0 * matches / block_length) : 0.0f;
+    hsp->alignment_length = block_length;
+    stats->mismatches = block_length - matches;
+    stats->gap_opens = 0;
+    stats->fragments = 1;
+    hsp->q_start = q_start + 1;
+    hsp->q_end = q_end;
+    if (lengths[4] == 1 && fields[4][0] == '-') {
+        hsp->s_start = t_end;
+        hsp->s_end = t_start + 1;
+    } else {
+        hsp->s_start = t_start + 1;
+        hsp->s_end = t_end;
+    }
+    stats->evalue = 0.0;
+    stats->bitscore = 0.0f;
+
+    // Optional SAM-like tags: NM:i edit distance, AS:i alignment score
+    for (int i = 12; i < n; i++) {
+        if (lengths[i] > 5 && strncmp(fields[i], "NM:i:", 5) == 0) {
+            stats->mismatches = parse_int(fields[i] + 5, lengths[i] - 5);
+        } else if (lengths[i] > 5 && strncmp(fields[i], "AS:i:", 5) == 0) {
+            stats->bitscore = (float)parse_int(fields[i] + 5, lengths[i] - 5);
+        }
+    }
+    return 1;
+}
+
+static unsigned long hash_bytes(const char *str, int len) {
+    unsigned long hash = 5381;
+    for (int i = 0; i < len; i++) {
+        hash = hash * 33 + (unsigned char)str[i];
+    }
+    return hash;
 }
 
-void free_memory(Gene *genes, Blastn *alignments) {
-   free(genes);
-   free(alignments);
+// Return the ID of str[0, len), adding it to the table the first time it is seen; -1 when out of memory
+int intern_string(StringTable *table, const char *str, int len) {
+    if (2 * (table->count + 1) > table->slot_count) {
+        int slot_count = table->slot_count ? table->slot_count * 2 : 64;
+        int *slots = (int *)malloc(slot_count * sizeof(int));
+        if (slots == NULL) {
+            return input_failed("allocating memory for string table");
+        }
+        for (int i = 0; i < slot_count; i++) slots[i] = -1;
+        for (int id = 0; id < table->count; id++) {
+            unsigned long h = hash_bytes(table->strings[id], (int)strlen(table->strings[id])) & (slot_count - 1);
+            while (slots[h] != -1) h = (h + 1) & (slot_count - 1);
+            slots[h] = id;
+        }
+        free(table->slots);
+        table->slots = slots;
+        table->slot_count = slot_count;
+    }
+
+    unsigned long mask = table->slot_count - 1;
+    unsigned long h = hash_bytes(str, len) & mask;
+    while (table->slots[h] != -1) {
+        const char *other = table->strings[table->slots[h]];
+        if (strncmp(other, str, len) == 0 && other[len] == '\0') {
+            return table->slots[h];
+        }
+        h = (h + 1) & mask;
+    }
+
+    if (table->count == table->capacity) {
+        int capacity = table->capacity ? table->capacity * 2 : 16;
+        char **strings = (char **)realloc(table->strings, capacity * sizeof(char *));
+        if (strings == NULL) {
+            return input_failed("allocating memory for string table");
+        }
+        table->strings = strings;
+        table->capacity = capacity;
+    }
+    table->strings[table->count] = copy_field(str, len);
+    if (table->strings[table->count] == NULL) {
+        return -1;
+    }
+    table->slots[h] = table->count;
+    return table->count++;
 }
 
-int main(int argc, char *argv[]) {
-   char *transfer_file = NULL;
-   char *location_file = NULL;
-   char *output_file = NULL;
+// Append one alignment; returns -1, leaving the set as it was, when out of memory
+int append_alignment(AlignmentSet *set, const Blastn *row, const AlignmentStats *stats) {
+    if (set->count == set->capacity) {
+        int capacity = set->capacity ? set->capacity * 2 : 1024;
+        Blastn *rows = (Blastn *)realloc(set->rows, capacity * sizeof(Blastn));
+        if (rows != NULL) set->rows = rows;
+        AlignmentStats *grown_stats = (AlignmentStats *)realloc(set->stats, capacity * sizeof(AlignmentStats));
+        if (grown_stats != NULL) set->stats = grown_stats;
+        if (rows == NULL || grown_stats == NULL) {
+            return input_failed("allocating memory for alignments");
+        }
+        set->capacity = capacity;
+    }
+    set->rows[set->count] = *row;
+    set->stats[set->count] = *stats;
+    set->count++;
+    return 0;
+}
+
+void free_alignments(AlignmentSet *set) {
+    for (int i = 0; i < set->ids.count; i++) {
+        free(set->ids.strings[i]);
+    }
+    free(set->ids.strings);
+    free(set->ids.slots);
+    free(set->rows);
+    free(set->stats);
+}
+
+static int passes_filters(const Filters *filters, const Blastn *row, const AlignmentStats *stats) {
+    return row->identity >= filters->min_identity && row->alignment_length >= filters->min_length &&
+           (filters->max_evalue < 0 || stats->evalue <= filters->max_evalue) && stats->bitscore >= filters->min_bitscore;
+}
+
+// Read BLAST tabular output (-outfmt 6) or PAF in one pass over the mapped file,
+// dropping rows rejected by the filters before their IDs are interned. Returns -1, with the set
+// empty, when the file cannot be loaded
+int read_alignments(const char *filename, int format, const Filters *filters, AlignmentSet *alignments) {
+    InputBuffer in;
+    memset(alignments, 0, sizeof(AlignmentSet));
+    if (open_input(filename, format == FORMAT_PAF ? "PAF" : "BLASTN", &in) != 0) {
+        return -1;
+    }
+
+    int skipped = 0, failed = 0;
+
+    const char *p = in.data, *end = in.data + in.length;
+    while (p < end) {
+        const char *eol = memchr(p, '\n', end - p);
+        if (eol == NULL) eol = end;
+        const char *line_end = (eol > p && eol[-1] == '\r') ? eol - 1 : eol;
+
+        if (p[0] != '#' && line_end > p) {
+            Blastn row;
+            AlignmentStats stats;
+            const char *query, *subject;
+            int query_len, subject_len;
+            int parsed = format == FORMAT_PAF
+                ? parse_paf_row(p, line_end, &row, &stats, &query, &query_len, &subject, &subject_len)
+                : parse_blast6_row(p, line_end, &row, &stats, &query, &query_len, &subject, &subject_len);
+            if (!parsed) {
+                skipped++;
+                p = eol + 1;
+                continue;
+            }
+
+            // Apply the filters before anything is stored, so rejected rows cost only their parse
+            if (!passes_filters(filters, &row, &stats)) {
+                p = eol + 1;
+                continue;
+            }
+            row.query = intern_string(&alignments->ids, query, query_len);
+            row.subject = intern_string(&alignments->ids, subject, subject_len);
+            if (row.query < 0 || row.subject < 0 || append_alignment(alignments, &row, &stats) != 0) {
+                failed = 1;
+                break;
+            }
+        }
+        p = eol + 1;
+    }
+    if (skipped > 0) {
+        fprintf(stderr, "Warning: %d %s lines with fewer than %d columns skipped\n", skipped,
+                format == FORMAT_PAF ? "PAF" : "BLASTN", format == FORMAT_PAF ? 12 : 10);
+    }
+
+    close_input(&in);
+    if (failed) {
+        free_alignments(alignments);
+        memset(alignments, 0, sizeof(AlignmentSet));
+        return -1;
+    }
+    return 0;
+}
+
+// Define a struct to hold the sort key of an alignment for merging
+typedef struct {
+    int query;
+    int subject;
+    int strand;
+    int lo;
+    int hi;
+    int index;
+} MergeKey;
+
+// Define a struct to hold a block of merged alignments
+typedef struct {
+    int query;
+    int subject;
+    int strand;
+    int q_lo;
+    int q_hi;
+    int s_lo;
+    int s_hi;
+    int first;          // sort position of its first alignment, the block order
+    int best;           // sort position of the best-identity alignment, -1 once merged away
+    int fragments;
+} MergeBlock;
+
+static int compare_merge_keys(const void *a, const void *b) {
+    const MergeKey *x = (const MergeKey *)a;
+    const MergeKey *y = (const MergeKey *)b;
+    if (x->query != y->query) return x->query - y->query;
+    if (x->subject != y->subject) return x->subject - y->subject;
+    if (x->strand != y->strand) return y->strand - x->strand;
+    if (x->lo != y->lo) return x->lo < y->lo ? -1 : 1;
+    if (x->hi != y->hi) return x->hi > y->hi ? -1 : 1;
+    return x->index - y->index;
+}
+
+static int compare_merge_blocks(const void *a, const void *b) {
+    return ((const MergeBlock *)a)->first - ((const MergeBlock *)b)->first;
+}
+
+// Both ranges overlap or lie within gap bases
+static int blocks_touch(const MergeBlock *a, const MergeBlock *b, int gap) {
+    return a->q_lo <= b->q_hi + gap + 1 && b->q_lo <= a->q_hi + gap + 1 &&
+           a->s_lo <= b->s_hi + gap + 1 && b->s_lo <= a->s_hi + gap + 1;
+}
+
+static void join_blocks(const AlignmentSet *set, const MergeKey *keys, MergeBlock *into, MergeBlock *from) {
+    const Blastn *best = &set->rows[keys[into->best].index];
+    const Blastn *row = &set->rows[keys[from->best].index];
+    if (row->identity > best->identity || (row->identity == best->identity && (row->alignment_length > best->alignment_length ||
+        (row->alignment_length == best->alignment_length && from->best < into->best)))) {
+        into->best = from->best;
+    }
+    into->first = min(into->first, from->first);
+    into->q_lo = min(into->q_lo, from->q_lo);
+    into->q_hi = max(into->q_hi, from->q_hi);
+    into->s_lo = min(into->s_lo, from->s_lo);
+    into->s_hi = max(into->s_hi, from->s_hi);
+    into->fragments += from->fragments;
+    from->best = -1;
+}
+
+// Collapse contained, overlapping and near-duplicate alignments: alignments of one query/subject pair
+// on the same strand whose query ranges and subject ranges both overlap or lie within gap bases merge
+// into one block spanning their union. A block keeps the identity and statistics of its best-identity
+// alignment (the longest on ties) and counts its fragments. Blocks are swept in query order,
+// retiring the open blocks the sweep has passed; a block touching several open blocks joins them all.
+// Joined blocks may now touch blocks they did not before, so the sweep is repeated until nothing merges
+void merge_alignments(AlignmentSet *set, int gap) {
+    int n = set->count;
+    MergeKey *keys = (MergeKey *)malloc((n > 0 ? n : 1) * sizeof(MergeKey));
+    MergeBlock *blocks = (MergeBlock *)malloc((n > 0 ? n : 1) * sizeof(MergeBlock));
+    int *open = (int *)malloc((n > 0 ? n : 1) * sizeof(int));
+    if (keys == NULL || blocks == NULL || open == NULL) {
+        fprintf(stderr, "Error allocating memory for merging\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < n; i++) {
+        const Blastn *row = &set->rows[i];
+        keys[i].query = row->query;
+        keys[i].subject = row->subject;
+        keys[i].strand = (row->q_end >= row->q_start) == (row->s_end >= row->s_start) ? 1 : -1;
+        keys[i].lo = min(row->q_start, row->q_end);
+        keys[i].hi = max(row->q_start, row->q_end);
+        keys[i].index = i;
+    }
+    qsort(keys, n, sizeof(MergeKey), compare_merge_keys);
+
+    // Every alignment starts as a block of its own
+    for (int i = 0; i < n; i++) {
+        const Blastn *row = &set->rows[keys[i].index];
+        blocks[i].query = keys[i].query;
+        blocks[i].subject = keys[i].subject;
+        blocks[i].strand = keys[i].strand;
+        blocks[i].q_lo = keys[i].lo;
+        blocks[i].q_hi = keys[i].hi;
+        blocks[i].s_lo = min(row->s_start, row->s_end);
+        blocks[i].s_hi = max(row->s_start, row->s_end);
+        blocks[i].first = i;
+        blocks[i].best = i;
+        blocks[i].fragments = set->stats[keys[i].index].fragments;
+    }
+
+    int block_count = n, merged;
+    do {
+        merged = 0;
+        int open_count = 0;
+        for (int i = 0; i < block_count; i++) {
+            MergeBlock *block = &blocks[i];
+            if (i == 0 || block->query != blocks[i - 1].query || block->subject != blocks[i - 1].subject ||
+                block->strand != blocks[i - 1].strand) {
+                open_count = 0;
+            }
+
+            int target = -1;
+            for (int b = 0; b < open_count;) {
+                MergeBlock *other = &blocks[open[b]];
+                if (other->q_hi + gap + 1 < block->q_lo) {
+                    open[b] = open[--open_count];   // the sweep has passed it
+                    continue;
+                }
+                if (blocks_touch(other, block, gap)) {
+                    if (target < 0) {
+                        target = open[b];
+                    } else {
+                        join_blocks(set, keys, &blocks[target], other);
+                        merged++;
+                        open[b] = open[--open_count];
+                        continue;
+                    }
+                }
+                b++;
+            }
+
+            if (target < 0) {
+                open[open_count++] = i;
+            } else {
+                join_blocks(set, keys, &blocks[target], block);
+                merged++;
+            }
+        }
+
+        // Keep the surviving blocks in query order for the next sweep
+        int live = 0;
+        for (int i = 0; i < block_count; i++) {
+            if (blocks[i].best >= 0) {
+                blocks[live++] = blocks[i];
+            }
+        }
+        block_count = live;
+        qsort(blocks, block_count, sizeof(MergeBlock), compare_merge_blocks);
+    } while (merged > 0);
+
+    // Blocks are in query order within each pair and strand
+    Blastn *rows = (Blastn *)malloc((block_count > 0 ? block_count : 1) * sizeof(Blastn));
+    AlignmentStats *stats = (AlignmentStats *)malloc((block_count > 0 ? block_count : 1) * sizeof(AlignmentStats));
+    if (rows == NULL || stats == NULL) {
+        fprintf(stderr, "Error allocating memory for merging\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int b = 0; b < block_count; b++) {
+        const MergeBlock *block = &blocks[b];
+        const Blastn *best = &set->rows[keys[block->best].index];
+        int plus = (best->q_end >= best->q_start) == (best->s_end >= best->s_start);
+        rows[b] = *best;
+        rows[b].q_start = block->q_lo;
+        rows[b].q_end = block->q_hi;
+        rows[b].s_start = plus ? block->s_lo : block->s_hi;
+        rows[b].s_end = plus ? block->s_hi : block->s_lo;
+        rows[b].alignment_length = block->q_hi - block->q_lo + 1;
+        stats[b] = set->stats[keys[block->best].index];
+        stats[b].fragments = block->fragments;
+    }
+
+    free(keys);
+    free(blocks);
+    free(open);
+    free(set->rows);
+    free(set->stats);
+    set->rows = rows;
+    set->stats = stats;
+    set->count = block_count;
+    set->capacity = block_count;
+    set->merged = 1;
+}
+
+// Read the records of a FASTA file; bases are upper-cased and anything but ACGT becomes N
+void read_fasta(const char *filename, Sequence **records, int *record_count) {
+    InputBuffer in;
+    if (open_input(filename, "FASTA", &in) != 0) {
+        exit(EXIT_FAILURE);
+    }
+
+    int capacity = 16;
+    *record_count = 0;
+    *records = (Sequence *)malloc(capacity * sizeof(Sequence));
+    OutputBuffer seq = {NULL, 0, 0};
+    if (*records == NULL) {
+        fprintf(stderr, "Error allocating memory for sequences\n");
+        exit(EXIT_FAILURE);
+    }
+
+    const char *p = in.data, *end = in.data + in.length;
+    while (p <= end) {
+        const char *eol = p < end ? memchr(p, '\n', end - p) : NULL;
+        if (eol == NULL) eol = end;
+        const char *line_end = (eol > p && eol[-1] == '\r') ? eol - 1 : eol;
+
+        if (p >= end || *p == '>') {
+            if (*record_count > 0) {
+                Sequence *record = &(*records)[*record_count - 1];
+                record->length = (int)seq.length;
+                record->seq = copy_field(seq.data ? seq.data : "", seq.length);
+                if (record->seq == NULL) {
+                    exit(EXIT_FAILURE);
+                }
+                seq.length = 0;
+            }
+            if (p >= end) {
+                break;
+            }
+            if (*record_count == capacity) {
+                capacity *= 2;
+                *records = (Sequence *)realloc(*records, capacity * sizeof(Sequence));
+                if (*records == NULL) {
+                    fprintf(stderr, "Error allocating memory for sequences\n");
+                    exit(EXIT_FAILURE);
+                }
+            }
+            const char *name = p + 1;
+            const char *name_end = name;
+            while (name_end < line_end && *name_end != ' ' && *name_end != '\t') name_end++;
+            (*records)[(*record_count)++].name = copy_field(name, (int)(name_end - name));
+            if ((*records)[*record_count - 1].name == NULL) {
+                exit(EXIT_FAILURE);
+            }
+        } else if (*record_count > 0) {
+            if (seq.length + (line_end - p) + 1 > seq.capacity) {
+                seq.capacity = (seq.length + (line_end - p) + 1) * 2;
+                seq.data = (char *)realloc(seq.data, seq.capacity);
+                if (seq.data == NULL) {
+                    fprintf(stderr, "Error allocating memory for sequences\n");
+                    exit(EXIT_FAILURE);
+                }
+            }
+            for (const char *c = p; c < line_end; c++) {
+                char base = (char)(*c & ~0x20);
+                if (*c == ' ' || *c == '\t') continue;
+                seq.data[seq.length++] = base == 'A' || base == 'C' || base == 'G' || base == 'T' ? base : 'N';
+            }
+        }
+        p = eol + 1;
+    }
+
+    if (*record_count == 0) {
+        fprintf(stderr, "Error: No sequences in FASTA file %s\n", filename);
+        exit(EXIT_FAILURE);
+    }
+    free(seq.data);
+    close_input(&in);
+}
+
+void free_sequences(Sequence *records, int record_count) {
+    for (int i = 0; i < record_count; i++) {
+        free(records[i].name);
+        free(records[i].seq);
+    }
+    free(records);
+}
+
+static int base_code(char base) {
+    switch (base) {
+        case 'A': return 0;
+        case 'C': return 1;
+        case 'G': return 2;
+        case 'T': return 3;
+        default: return -1;
+    }
+}
+
+static int compare_seeds(const void *a, const void *b) {
+    const Seed *x = (const Seed *)a;
+    const Seed *y = (const Seed *)b;
+    if (x->kmer != y->kmer) return x->kmer < y->kmer ? -1 : 1;
+    if (x->record != y->record) return x->record - y->record;
+    return x->pos - y->pos;
+}
+
+// Index every k-mer of the donor records, dropping k-mers more frequent than MAX_SEED_OCCURRENCES (repeats)
+SeedIndex *build_seed_index(const Sequence *donors, int donor_count, int k) {
+    SeedIndex *index = (SeedIndex *)malloc(sizeof(SeedIndex));
+    size_t total = 0;
+    for (int i = 0; i < donor_count; i++) {
+        total += donors[i].length >= k ? donors[i].length - k + 1 : 0;
+    }
+    if (index == NULL || (index->seeds = (Seed *)malloc((total > 0 ? total : 1) * sizeof(Seed))) == NULL) {
+        fprintf(stderr, "Error allocating memory for seed index\n");
+        exit(EXIT_FAILURE);
+    }
+    index->k = k;
+    index->count = 0;
+
+    uint64_t mask = (k == 32) ? ~0ULL : ((1ULL << (2 * k)) - 1);
+    for (int r = 0; r < donor_count; r++) {
+        uint64_t kmer = 0;
+        int valid = 0;
+        for (int i = 0; i < donors[r].length; i++) {
+            int code = base_code(donors[r].seq[i]);
+            if (code < 0) {
+                valid = 0;
+                continue;
+            }
+            kmer = ((kmer << 2) | (uint64_t)code) & mask;
+            if (++valid >= k) {
+                Seed *seed = &index->seeds[index->count++];
+                seed->kmer = kmer;
+                seed->record = r;
+                seed->pos = i - k + 1;
+            }
+        }
+    }
+    qsort(index->seeds, index->count, sizeof(Seed), compare_seeds);
+
+    // Compact away over-represented k-mers
+    size_t kept = 0;
+    for (size_t i = 0; i < index->count;) {
+        size_t j = i;
+        while (j < index->count && index->seeds[j].kmer == index->seeds[i].kmer) j++;
+        if (j - i <= MAX_SEED_OCCURRENCES) {
+            memmove(&index->seeds[kept], &index->seeds[i], (j - i) * sizeof(Seed));
+            kept += j - i;
+        }
+        i = j;
+    }
+    index->count = kept;
+
+    index->bucket_bits = min(2 * k, SEED_BUCKET_BITS);
+    size_t bucket_count = (size_t)1 << index->bucket_bits;
+    index->buckets = (size_t *)malloc((bucket_count + 1) * sizeof(size_t));
+    if (index->buckets == NULL) {
+        fprintf(stderr, "Error allocating memory for seed index\n");
+        exit(EXIT_FAILURE);
+    }
+    size_t s = 0;
+    for (size_t b = 0; b <= bucket_count; b++) {
+        while (s < index->count && (index->seeds[s].kmer >> (2 * k - index->bucket_bits)) < b) s++;
+        index->buckets[b] = s;
+    }
+    return index;
+}
+
+// Find the run of seeds with this k-mer; returns its length and sets *first
+static size_t lookup_seeds(const SeedIndex *index, uint64_t kmer, size_t *first) {
+    size_t bucket = (size_t)(kmer >> (2 * index->k - index->bucket_bits));
+    size_t lo = index->buckets[bucket], hi = index->buckets[bucket + 1];
+    if (lo == hi) {
+        *first = lo;
+        return 0;
+    }
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (index->seeds[mid].kmer < kmer) lo = mid + 1;
+        else hi = mid;
+    }
+    *first = lo;
+    while (hi < index->count && index->seeds[hi].kmer == kmer) hi++;
+    return hi - lo;
+}
+
+void free_seed_index(SeedIndex *index) {
+    free(index->seeds);
+    free(index->buckets);
+    free(index);
+}
+
+// Remember how far each diagonal of the current work unit has been extended
+static int diagonal_slot(DiagonalTable *table, long long diagonal) {
+    if (2 * (table->used + 1) > table->capacity) {
+        DiagonalTable grown = {NULL, NULL, 0, table->capacity ? table->capacity * 2 : 1024};
+        grown.keys = (long long *)malloc(grown.capacity * sizeof(long long));
+        grown.ends = (int *)malloc(grown.capacity * sizeof(int));
+        if (grown.keys == NULL || grown.ends == NULL) {
+            fprintf(stderr, "Error allocating memory for diagonal table\n");
+            exit(EXIT_FAILURE);
+        }
+        for (int i = 0; i < grown.capacity; i++) grown.ends[i] = -1;
+        for (int i = 0; i < table->capacity; i++) {
+            if (table->ends[i] >= 0) {
+                int slot = diagonal_slot(&grown, table->keys[i]);
+                grown.keys[slot] = table->keys[i];
+                grown.ends[slot] = table->ends[i];
+                grown.used++;
+            }
+        }
+        free(table->keys);
+        free(table->ends);
+        *table = grown;
+    }
+    unsigned long long h = (unsigned long long)diagonal * 0x9E3779B97F4A7C15ULL;
+    int slot = (int)((h >> 32) % (unsigned long long)table->capacity);
+    while (table->ends[slot] >= 0 && table->keys[slot] != diagonal) {
+        slot = (slot + 1) % table->capacity;
+    }
+    return slot;
+}
+
+// Ungapped X-drop extension of an exact seed (match +1, mismatch -2); fills the HSP in scan coordinates
+static void extend_seed(const Sequence *donor, int d, const char *target, int target_length, int t, int k,
+                        int *d_begin, int *t_begin, int *length, int *matches, int *score) {
+    int s = 0, best = 0, best_len = 0, best_matches = 0, m = 0, i;
+
+    // Right of the seed
+    for (i = 0; d + k + i < donor->length && t + k + i < target_length; i++) {
+        int match = donor->seq[d + k + i] == target[t + k + i] && donor->seq[d + k + i] != 'N';
+        s += match ? FIND_MATCH : FIND_MISMATCH;
+        m += match;
+        if (s > best) {
+            best = s;
+            best_len = i + 1;
+            best_matches = m;
+        } else if (best - s > FIND_XDROP) {
+            break;
+        }
+    }
+    int right = best_len, right_score = best, right_matches = best_matches;
+
+    // Left of the seed
+    s = best = best_len = best_matches = m = 0;
+    for (i = 1; d - i >= 0 && t - i >= 0; i++) {
+        int match = donor->seq[d - i] == target[t - i] && donor->seq[d - i] != 'N';
+        s += match ? FIND_MATCH : FIND_MISMATCH;
+        m += match;
+        if (s > best) {
+            best = s;
+            best_len = i;
+            best_matches = m;
+        } else if (best - s > FIND_XDROP) {
+            break;
+        }
+    }
+
+    *d_begin = d - best_len;
+    *t_begin = t - best_len;
+    *length = best_len + k + right;
+    *matches = best_matches + k + right_matches;
+    *score = best + k * FIND_MATCH + right_score;
+}
+
+static void push_found(AlignmentList *list, const FoundHsp *hsp) {
+    if (list->count == list->capacity) {
+        list->capacity = list->capacity ? list->capacity * 2 : 64;
+        list->hsps = (FoundHsp *)realloc(list->hsps, list->capacity * sizeof(FoundHsp));
+        if (list->hsps == NULL) {
+            fprintf(stderr, "Error allocating memory for alignments\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    list->hsps[list->count++] = *hsp;
+}
+
+// Scan one FIND_CHUNK window of one recipient strand against the donor index
+static void find_in_unit(FindJob *job, int unit, AlignmentList *out, DiagonalTable *table) {
+    const FindUnit *u = &job->units[unit];
+    const Sequence *recipient = &job->recipients[u->record];
+    const char *target = u->strand > 0 ? recipient->seq : job->reverse[u->record];
+    int n = recipient->length, k = job->index->k;
+    int stop = min(u->begin + FIND_CHUNK, n - k + 1);
+    uint64_t mask = (k == 32) ? ~0ULL : ((1ULL << (2 * k)) - 1);
+    uint64_t kmer = 0;
+    int valid = 0;
+
+    table->used = 0;
+    for (int i = 0; i < table->capacity; i++) table->ends[i] = -1;
+
+    for (int i = u->begin; i < stop + k - 1 && i < n; i++) {
+        int code = base_code(target[i]);
+        if (code < 0) {
+            valid = 0;
+            continue;
+        }
+        kmer = ((kmer << 2) | (uint64_t)code) & mask;
+        if (++valid < k) {
+            continue;
+        }
+        int t = i - k + 1;
+        size_t first, hits = lookup_seeds(job->index, kmer, &first);
+        for (size_t h = first; h < first + hits; h++) {
+            const Seed *seed = &job->index->seeds[h];
+            long long diagonal = ((long long)seed->record << 32) + ((long long)t - seed->pos) + 0x7FFFFFFFLL;
+            int slot = diagonal_slot(table, diagonal);
+            if (table->ends[slot] > t) {
+                continue;   // already inside an HSP on this diagonal
+            }
+
+            int d_begin, t_begin, length, matches, score;
+            const Sequence *donor = &job->donors[seed->record];
+            extend_seed(donor, seed->pos, target, n, t, k, &d_begin, &t_begin, &length, &matches, &score);
+            if (table->ends[slot] < 0) table->used++;
+            table->keys[slot] = diagonal;
+            table->ends[slot] = t_begin + length;
+
+            FoundHsp hsp;
+            hsp.stats.evalue = job->search_space * exp(-FIND_LAMBDA * score);
+            if (hsp.stats.evalue > FIND_MAX_EVALUE) {
+                continue;
+            }
+            hsp.row.query = seed->record;
+            hsp.row.subject = u->record;
+            hsp.row.identity = (float)(100.0 * matches / length);
+            hsp.row.alignment_length = length;
+            hsp.row.q_start = d_begin + 1;
+            hsp.row.q_end = d_begin + length;
+            if (u->strand > 0) {
+                hsp.row.s_start = t_begin + 1;
+                hsp.row.s_end = t_begin + length;
+            } else {
+                hsp.row.s_start = n - t_begin;
+                hsp.row.s_end = n - (t_begin + length - 1);
+            }
+            hsp.stats.mismatches = length - matches;
+            hsp.stats.gap_opens = 0;
+            hsp.stats.fragments = 1;
+            hsp.stats.bitscore = (float)((FIND_LAMBDA * score - log(FIND_K)) / log(2.0));
+            push_found(out, &hsp);
+        }
+    }
+}
+
+static void *find_worker(void *arg) {
+    FindJob *job = (FindJob *)arg;
+    DiagonalTable table = {NULL, NULL, 0, 0};
+    int unit;
+    while ((unit = __atomic_fetch_add(&job->next_unit, 1, __ATOMIC_RELAXED)) < job->unit_count) {
+        find_in_unit(job, unit, &job->results[unit], &table);
+    }
+    free(table.keys);
+    free(table.ends);
+    return NULL;
+}
+
+static int compare_found(const void *a, const void *b) {
+    const FoundHsp *x = (const FoundHsp *)a;
+    const FoundHsp *y = (const FoundHsp *)b;
+    if (x->row.query != y->row.query) return x->row.query - y->row.query;
+    if (x->row.subject != y->row.subject) return x->row.subject - y->row.subject;
+    if (x->stats.bitscore != y->stats.bitscore) return x->stats.bitscore > y->stats.bitscore ? -1 : 1;
+    if (x->row.q_start != y->row.q_start) return x->row.q_start - y->row.q_start;
+    return x->row.s_start - y->row.s_start;
+}
+
+// Find donor-to-recipient HSPs without an external aligner: exact k-mer seeds from the donor index,
+// both recipient strands scanned in fixed windows across threads, seeds extended by ungapped X-drop.
+// The windows do not depend on the thread count, so the HSPs are the same for any -j
+void find_alignments(const char *donor_file, const char *recipient_file, int k, int threads, const Filters *filters,
+                     AlignmentSet *alignments) {
+    FindJob job;
+    int donor_count, recipient_count;
+    read_fasta(donor_file, &job.donors, &donor_count);
+    read_fasta(recipient_file, &job.recipients, &recipient_count);
+    job.index = build_seed_index(job.donors, donor_count, k);
+
+    double donor_length = 0, recipient_length = 0;
+    for (int i = 0; i < donor_count; i++) donor_length += job.donors[i].length;
+    for (int i = 0; i < recipient_count; i++) recipient_length += job.recipients[i].length;
+    job.search_space = FIND_K * donor_length * recipient_length;
+
+    // Reverse complements of the recipients, scanned as the minus strand
+    job.reverse = (char **)malloc(recipient_count * sizeof(char *));
+    job.unit_count = 0;
+    for (int r = 0; r < recipient_count; r++) {
+        int n = job.recipients[r].length;
+        job.reverse[r] = (char *)malloc(n + 1);
+        if (job.reverse[r] == NULL) {
+            fprintf(stderr, "Error allocating memory for reverse complement\n");
+            exit(EXIT_FAILURE);
+        }
+        for (int i = 0; i < n; i++) {
+            char base = job.recipients[r].seq[n - 1 - i];
+            job.reverse[r][i] = base == 'A' ? 'T' : base == 'C' ? 'G' : base == 'G' ? 'C' : base == 'T' ? 'A' : 'N';
+        }
+        job.reverse[r][n] = '\0';
+        job.unit_count += 2 * ((n + FIND_CHUNK - 1) / FIND_CHUNK);
+    }
+    job.units = (FindUnit *)malloc((job.unit_count > 0 ? job.unit_count : 1) * sizeof(FindUnit));
+    job.results = (AlignmentList *)calloc(job.unit_count > 0 ? job.unit_count : 1, sizeof(AlignmentList));
+    if (job.units == NULL || job.results == NULL) {
+        fprintf(stderr, "Error allocating memory for search windows\n");
+        exit(EXIT_FAILURE);
+    }
+    int u = 0;
+    for (int r = 0; r < recipient_count; r++) {
+        for (int strand = 1; strand >= -1; strand -= 2) {
+            for (int begin = 0; begin < job.recipients[r].length; begin += FIND_CHUNK) {
+                job.units[u].record = r;
+                job.units[u].strand = strand;
+                job.units[u].begin = begin;
+                u++;
+            }
+        }
+    }
+    job.next_unit = 0;
+
+    if (threads > job.unit_count) {
+        threads = job.unit_count > 0 ? job.unit_count : 1;
+    }
+    pthread_t *workers = (pthread_t *)malloc(threads * sizeof(pthread_t));
+    for (int t = 0; t < threads; t++) {
+        if (pthread_create(&workers[t], NULL, find_worker, &job) != 0) {
+            fprintf(stderr, "Error creating search thread\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (int t = 0; t < threads; t++) {
+        pthread_join(workers[t], NULL);
+    }
+    free(workers);
+
+    // Gather the windows, keeping what passes the filters, sorted by donor and recipient record
+    // (file order) and score; windows meet at FIND_CHUNK boundaries, so drop the HSPs found twice there
+    int found_count = 0;
+    for (u = 0; u < job.unit_count; u++) found_count += job.results[u].count;
+    FoundHsp *found = (FoundHsp *)malloc((found_count > 0 ? found_count : 1) * sizeof(FoundHsp));
+    if (found == NULL) {
+        fprintf(stderr, "Error allocating memory for alignments\n");
+        exit(EXIT_FAILURE);
+    }
+    found_count = 0;
+    for (u = 0; u < job.unit_count; u++) {
+        for (int i = 0; i < job.results[u].count; i++) {
+            if (passes_filters(filters, &job.results[u].hsps[i].row, &job.results[u].hsps[i].stats)) {
+                found[found_count++] = job.results[u].hsps[i];
+            }
+        }
+        free(job.results[u].hsps);
+    }
+    qsort(found, found_count, sizeof(FoundHsp), compare_found);
+
+    // Record indexes become IDs in the set's string table
+    memset(alignments, 0, sizeof(AlignmentSet));
+    int *donor_ids = (int *)malloc(donor_count * sizeof(int));
+    int *recipient_ids = (int *)malloc(recipient_count * sizeof(int));
+    if (donor_ids == NULL || recipient_ids == NULL) {
+        fprintf(stderr, "Error allocating memory for sequence IDs\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int r = 0; r < donor_count; r++) {
+        donor_ids[r] = intern_string(&alignments->ids, job.donors[r].name, (int)strlen(job.donors[r].name));
+        if (donor_ids[r] < 0) {
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (int r = 0; r < recipient_count; r++) {
+        recipient_ids[r] = intern_string(&alignments->ids, job.recipients[r].name, (int)strlen(job.recipients[r].name));
+        if (recipient_ids[r] < 0) {
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (int i = 0; i < found_count; i++) {
+        Blastn *row = &found[i].row;
+        if (i > 0) {
+            const Blastn *last = &found[i - 1].row;
+            if (last->query == row->query && last->subject == row->subject && last->q_start == row->q_start &&
+                last->q_end == row->q_end && last->s_start == row->s_start && last->s_end == row->s_end) {
+                continue;
+            }
+        }
+        Blastn mapped = *row;
+        mapped.query = donor_ids[row->query];
+        mapped.subject = recipient_ids[row->subject];
+        if (append_alignment(alignments, &mapped, &found[i].stats) != 0) {
+            exit(EXIT_FAILURE);
+        }
+    }
+    free(found);
+    free(donor_ids);
+    free(recipient_ids);
+
+    for (int r = 0; r < recipient_count; r++) free(job.reverse[r]);
+    free(job.reverse);
+    free(job.units);
+    free(job.results);
+    free_seed_index(job.index);
+    free_sequences(job.donors, donor_count);
+    free_sequences(job.recipients, recipient_count);
+}
+
+// Write HSPs as BLAST tabular output (-outfmt 6)
+void write_alignments(const AlignmentSet *alignments, const char *filename) {
+    FILE *file = fopen(filename, "w");
+    if (file == NULL) {
+        fprintf(stderr, "Error opening alignment file: %s\n", filename);
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < alignments->count; i++) {
+        const Blastn *hsp = &alignments->rows[i];
+        const AlignmentStats *stats = &alignments->stats[i];
+        fprintf(file, "%s\t%s\t%.3f\t%d\t%d\t%d\t%d\t%d\t%d\t%d\t%.2e\t%.1f\n", alignments->ids.strings[hsp->query],
+                alignments->ids.strings[hsp->subject], hsp->identity, hsp->alignment_length, stats->mismatches,
+                stats->gap_opens, hsp->q_start, hsp->q_end, hsp->s_start, hsp->s_end, stats->evalue, stats->bitscore);
+    }
+    fclose(file);
+}
+
+static int compare_intervals(const void *a, const void *b) {
+    const GeneInterval *x = (const GeneInterval *)a;
+    const GeneInterval *y = (const GeneInterval *)b;
+    if (x->lo != y->lo) return x->lo < y->lo ? -1 : 1;
+    return x->gene - y->gene;
+}
+
+// Index the genes listed in members (indexes into genes)
+GeneIndex *build_gene_index(Gene *genes, const int *members, int member_count) {
+    GeneIndex *index = (GeneIndex *)malloc(sizeof(GeneIndex));
+    if (index == NULL || (index->intervals = (GeneInterval *)malloc((member_count > 0 ? member_count : 1) * sizeof(GeneInterval))) == NULL) {
+        fprintf(stderr, "Error allocating memory for gene index\n");
+        exit(EXIT_FAILURE);
+    }
+    index->count = member_count;
+    index->root_level = -1;
+
+    for (int i = 0; i < member_count; i++) {
+        Gene *gene = &genes[members[i]];
+        index->intervals[i].lo = min(gene->start, gene->end);
+        index->intervals[i].hi = max(gene->start, gene->end);
+        index->intervals[i].gene = members[i];
+    }
+    qsort(index->intervals, member_count, sizeof(GeneInterval), compare_intervals);
+    if (member_count == 0) {
+        return index;
+    }
+
+    // Fill max_hi bottom-up: a node at level k sits at an index whose k lowest bits are 1
+    GeneInterval *a = index->intervals;
+    int n = member_count;
+    int i, k, last_i = 0, last = 0;
+    for (i = 0; i < n; i += 2) {
+        last_i = i;
+        last = a[i].max_hi = a[i].hi;
+    }
+    for (k = 1; 1 << k <= n; k++) {
+        int x = 1 << (k - 1), i0 = (x << 1) - 1, step = x << 2;
+        for (i = i0; i < n; i += step) {
+            int el = a[i - x].max_hi;
+            int er = i + x < n ? a[i + x].max_hi : last;
+            a[i].max_hi = max(a[i].hi, max(el, er));
+        }
+        last_i = (last_i >> k & 1) ? last_i - x : last_i + x;
+        if (last_i < n && a[last_i].max_hi > last) {
+            last = a[last_i].max_hi;
+        }
+    }
+    index->root_level = k - 1;
+    return index;
+}
+
+static void push_hit(int **hits, int *hits_capacity, int *hit_count, int gene) {
+    if (*hit_count == *hits_capacity) {
+        *hits_capacity = *hits_capacity ? *hits_capacity * 2 : 16;
+        *hits = (int *)realloc(*hits, *hits_capacity * sizeof(int));
+        if (*hits == NULL) {
+            fprintf(stderr, "Error allocating memory for gene hits\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    (*hits)[(*hit_count)++] = gene;
+}
+
+// Append the genes whose [lo, hi] intersects the query [lo, hi] to the hit_count hits already
+// collected, and return the new count; all hits are left in location file order
+static int collect_gene_hits(const GeneIndex *index, int lo, int hi, int **hits, int *hits_capacity, int hit_count) {
+    struct { int level, node, left_done; } stack[64];
+    const GeneInterval *a = index->intervals;
+    int n = index->count, t = 0, first = hit_count;
+
+    if (index->root_level < 0) {
+        return hit_count;
+    }
+    stack[t].level = index->root_level, stack[t].node = (1 << index->root_level) - 1, stack[t++].left_done = 0;
+    while (t) {
+        int level = stack[t - 1].level, node = stack[t - 1].node, left_done = stack[t - 1].left_done;
+        t--;
+        if (level <= 3) {
+            // small subtree: scan it linearly
+            int i0 = node >> level << level, i1 = i0 + (1 << (level + 1)) - 1;
+            if (i1 > n) i1 = n;
+            for (int i = i0; i < i1 && a[i].lo <= hi; i++) {
+                if (a[i].hi >= lo) {
+                    push_hit(hits, hits_capacity, &hit_count, a[i].gene);
+                }
+            }
+        } else if (left_done == 0) {
+            int left = node - (1 << (level - 1));
+            stack[t].level = level, stack[t].node = node, stack[t++].left_done = 1;
+            if (left >= n || a[left].max_hi >= lo) {
+                stack[t].level = level - 1, stack[t].node = left, stack[t++].left_done = 0;
+            }
+        } else if (node < n && a[node].lo <= hi) {
+            if (a[node].hi >= lo) {
+                push_hit(hits, hits_capacity, &hit_count, a[node].gene);
+            }
+            stack[t].level = level - 1, stack[t].node = node + (1 << (level - 1)), stack[t++].left_done = 0;
+        }
+    }
+
+    // report genes in the order of the location file
+    for (int i = first > 0 ? first : 1; i < hit_count; i++) {
+        int g = (*hits)[i], j = i - 1;
+        while (j >= 0 && (*hits)[j] > g) {
+            (*hits)[j + 1] = (*hits)[j];
+            j--;
+        }
+        (*hits)[j + 1] = g;
+    }
+    return hit_count;
+}
+
+// Collect the genes whose [lo, hi] intersects the query [lo, hi], in location file order
+int query_gene_index(const GeneIndex *index, int lo, int hi, int **hits, int *hits_capacity) {
+    return collect_gene_hits(index, lo, hi, hits, hits_capacity, 0);
+}
+
+// Collect the genes of both indexes of a query ID, in location file order
+int query_genes(const QueryIndex *query, int lo, int hi, int **hits, int *hits_capacity) {
+    int hit_count = query->own ? collect_gene_hits(query->own, lo, hi, hits, hits_capacity, 0) : 0;
+    if (query->unnamed) {
+        hit_count = collect_gene_hits(query->unnamed, lo, hi, hits, hits_capacity, hit_count);
+    }
+    return hit_count;
+}
+
+void free_gene_index(GeneIndex *index) {
+    free(index->intervals);
+    free(index);
+}
+
+static unsigned long hash_string(const char *str) {
+    unsigned long hash = 5381;
+    while (*str) {
+        hash = hash * 33 + (unsigned char)*str++;
+    }
+    return hash;
+}
+
+// Find the slot of seqid (NULL: genes without a sequence ID), or the empty slot where it belongs
+static int *gene_index_slot(const GeneIndexMap *map, const char *seqid) {
+    unsigned long mask = map->slot_count - 1;
+    unsigned long h = (seqid ? hash_string(seqid) : 0) & mask;
+    while (map->slots[h] != -1) {
+        const char *other = map->sequences[map->slots[h]].seqid;
+        if (seqid == NULL ? other == NULL : (other != NULL && strcmp(other, seqid) == 0)) {
+            break;
+        }
+        h = (h + 1) & mask;
+    }
+    return &map->slots[h];
+}
+
+// Bucket the genes by sequence ID and build one interval index per sequence
+GeneIndexMap *build_gene_index_map(Gene *genes, int gene_count) {
+    GeneIndexMap *map = (GeneIndexMap *)calloc(1, sizeof(GeneIndexMap));
+    int *bucket = (int *)malloc((gene_count > 0 ? gene_count : 1) * sizeof(int));
+    int *members = (int *)malloc((gene_count > 0 ? gene_count : 1) * sizeof(int));
+    int *sizes = (int *)calloc(gene_count + 1, sizeof(int));
+    map->slot_count = 16;
+    while (map->slot_count < gene_count * 2) map->slot_count *= 2;
+    map->slots = (int *)malloc(map->slot_count * sizeof(int));
+    map->sequences = (SequenceGenes *)malloc((gene_count > 0 ? gene_count : 1) * sizeof(SequenceGenes));
+    if (map == NULL || bucket == NULL || members == NULL || sizes == NULL || map->slots == NULL || map->sequences == NULL) {
+        fprintf(stderr, "Error allocating memory for gene index\n");
+        exit(EXIT_FAILURE);
+    }
+    memset(map->slots, -1, map->slot_count * sizeof(int));
+
+    for (int i = 0; i < gene_count; i++) {
+        int *slot = gene_index_slot(map, genes[i].seqid);
+        if (*slot == -1) {
+            map->sequences[map->count].seqid = genes[i].seqid;
+            *slot = map->count++;
+        }
+        bucket[i] = *slot;
+        sizes[*slot]++;
+    }
+
+    // counting sort of the genes by bucket keeps file order inside each bucket
+    int offset = 0;
+    for (int b = 0; b < map->count; b++) {
+        int size = sizes[b];
+        sizes[b] = offset;
+        offset += size;
+    }
+    for (int i = 0; i < gene_count; i++) {
+        members[sizes[bucket[i]]++] = i;
+    }
+    offset = 0;
+    for (int b = 0; b < map->count; b++) {
+        map->sequences[b].index = build_gene_index(genes, members + offset, sizes[b] - offset);
+        offset = sizes[b];
+    }
+
+    // genes without a sequence ID, or the only sequence there is, match any query
+    int unnamed = *gene_index_slot(map, NULL);
+    if (unnamed != -1) {
+        map->unnamed = map->sequences[unnamed].index;
+        map->fallback = map->unnamed;
+    } else if (map->count == 1) {
+        map->fallback = map->sequences[0].index;
+    }
+
+    free(bucket);
+    free(members);
+    free(sizes);
+    return map;
+}
+
+// The genes a query on seqid is matched against: its own sequence's plus those without a sequence ID,
+// or the fallback when seqid has no genes of its own
+QueryIndex lookup_gene_index(const GeneIndexMap *map, const char *seqid) {
+    QueryIndex query = {map->fallback, NULL};
+    int slot = *gene_index_slot(map, seqid);
+    if (slot != -1) {
+        query.own = map->sequences[slot].index;
+        query.unnamed = map->unnamed != query.own ? map->unnamed : NULL;
+    }
+    return query;
+}
+
+void free_gene_index_map(GeneIndexMap *map) {
+    for (int i = 0; i < map->count; i++) {
+        free_gene_index(map->sequences[i].index);
+    }
+    free(map->sequences);
+    free(map->slots);
+    free(map);
+}
+
+void buffer_printf(OutputBuffer *buffer, const char *format, ...) {
+    va_list args;
+    for (;;) {
+        size_t room = buffer->capacity - buffer->length;
+        va_start(args, format);
+        int needed = vsnprintf(buffer->data + buffer->length, room, format, args);
+        va_end(args);
+        if (needed >= 0 && (size_t)needed < room) {
+            buffer->length += needed;
+            return;
+        }
+        buffer->capacity = buffer->capacity ? buffer->capacity * 2 : 65536;
+        while (needed >= 0 && buffer->capacity - buffer->length <= (size_t)needed) {
+            buffer->capacity *= 2;
+        }
+        buffer->data = (char *)realloc(buffer->data, buffer->capacity);
+        if (buffer->data == NULL) {
+            fprintf(stderr, "Error allocating memory for output\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+// Define a struct to hold the shared state of the overlap workers
+typedef struct {
+    Gene *genes;
+    const AlignmentSet *alignments;
+    const QueryIndex *query_indexes;    // gene indexes of each query ID
+    int alignment_count;
+    OutputBuffer *chunks;       // one buffer per ALIGNMENT_CHUNK alignments, written in input order; NULL without rows
+    CoverageList *coverage;     // covered gene segments per chunk, NULL without a coverage report
+    GeneColumn *gene_lists;     // gene lists per chunk, NULL without a columnar file
+    int chunk_count;
+    int next_chunk;
+    const char *pair;           // manifest pair name printed as the first column, NULL for none
+} OverlapJob;
+
+static void push_gene(GeneList *list, int gene) {
+    if (list->count == list->capacity) {
+        list->capacity = list->capacity ? list->capacity * 2 : 64;
+        list->genes = (int *)realloc(list->genes, list->capacity * sizeof(int));
+        if (list->genes == NULL) {
+            fprintf(stderr, "Error allocating memory for gene lists\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    list->genes[list->count++] = gene;
+}
+
+// Split the genes hit by an alignment spanning [q_lo, q_hi] into the ones it contains completely
+// and the ones it cuts, in file order
+static void classify_genes(const Gene *genes, const int *hits, int hit_count, int q_lo, int q_hi, GeneList *complete, GeneList *partial) {
+    complete->count = 0;
+    partial->count = 0;
+    for (int h = 0; h < hit_count; h++) {
+        const Gene *gene = &genes[hits[h]];
+        if (min(gene->start, gene->end) >= q_lo && max(gene->start, gene->end) <= q_hi) {
+            push_gene(complete, hits[h]);
+        } else if ((gene->start > q_lo && gene->start < q_hi) || (gene->end > q_lo && gene->end < q_hi)) {
+            push_gene(partial, hits[h]);
+        }
+    }
+}
+
+static void add_gene_list(GeneColumn *column, int row, const GeneList *complete, const GeneList *partial) {
+    int need = column->count + complete->count + partial->count;
+    if (column->counts == NULL || need > column->capacity) {
+        column->capacity = max(need, column->capacity ? column->capacity * 2 : 1024);
+        column->genes = (int *)realloc(column->genes, column->capacity * sizeof(int));
+        column->complete = (unsigned char *)realloc(column->complete, column->capacity);
+        if (column->counts == NULL) {
+            column->counts = (int *)calloc(ALIGNMENT_CHUNK, sizeof(int));
+        }
+        if (column->counts == NULL || column->genes == NULL || column->complete == NULL) {
+            fprintf(stderr, "Error allocating memory for gene lists\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    column->counts[row] = complete->count + partial->count;
+    for (int g = 0; g < complete->count; g++, column->count++) {
+        column->genes[column->count] = complete->genes[g];
+        column->complete[column->count] = 1;
+    }
+    for (int g = 0; g < partial->count; g++, column->count++) {
+        column->genes[column->count] = partial->genes[g];
+        column->complete[column->count] = 0;
+    }
+}
+
+static void add_coverage(CoverageList *coverage, int gene, int lo, int hi, float identity) {
+    if (coverage->count == coverage->capacity) {
+        coverage->capacity = coverage->capacity ? coverage->capacity * 2 : 1024;
+        coverage->segments = (CoverageSegment *)realloc(coverage->segments, coverage->capacity * sizeof(CoverageSegment));
+        if (coverage->segments == NULL) {
+            fprintf(stderr, "Error allocating memory for gene coverage\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    CoverageSegment *segment = &coverage->segments[coverage->count++];
+    segment->gene = gene;
+    segment->lo = lo;
+    segment->hi = hi;
+    segment->identity = identity;
+}
+
+// Classify the genes of alignments [begin, end) and format their rows
+static void classify_alignments(OverlapJob *job, int begin, int end, OutputBuffer *out, CoverageList *coverage, GeneColumn *column) {
+    Gene *genes = job->genes;
+    const Blastn *alignments = job->alignments->rows;
+    char **ids = job->alignments->ids.strings;
+    int *hits = NULL;
+    int hits_capacity = 0;
+    GeneList complete = {NULL, 0, 0}, partial = {NULL, 0, 0};
+
+    for (int j = begin; j < end; j++) {
+        int q_lo = min(alignments[j].q_start, alignments[j].q_end);
+        int q_hi = max(alignments[j].q_start, alignments[j].q_end);
+        int hit_count = query_genes(&job->query_indexes[alignments[j].query], q_lo, q_hi, &hits, &hits_capacity);
+        if (coverage != NULL) {
+            for (int h = 0; h < hit_count; h++) {
+                const Gene *gene = &genes[hits[h]];
+                add_coverage(coverage, hits[h], max(q_lo, min(gene->start, gene->end)), min(q_hi, max(gene->start, gene->end)), alignments[j].identity);
+            }
+        }
+        classify_genes(genes, hits, hit_count, q_lo, q_hi, &complete, &partial);
+        if (verbosity >= 2) {
+            for (int g = 0; g < partial.count; g++) {
+                const Gene *gene = &genes[partial.genes[g]];
+                fprintf(stderr, "Partial overlap: %s %d %d with alignment %d (%d %d)\n", gene->name, gene->start, gene->end,
+                        j + 1, alignments[j].q_start, alignments[j].q_end);
+            }
+        }
+        if (column != NULL) {
+            add_gene_list(column, j - begin, &complete, &partial);
+        }
+        if (out == NULL) {
+            continue;
+        }
+
+        if (job->pair != NULL) {
+            buffer_printf(out, "%s\t", job->pair);
+        }
+        buffer_printf(out, "%d\t%s\t%s\t%.2f\t%d\t%d\t%d\t%d\t%d\t",
+                j + 1,
+                ids[alignments[j].query],
+                ids[alignments[j].subject],
+                alignments[j].identity,
+                alignments[j].alignment_length,
+                alignments[j].q_start,
+                alignments[j].q_end,
+                alignments[j].s_start,
+                alignments[j].s_end);
+        if (job->alignments->merged) {
+            buffer_printf(out, "%d\t", job->alignments->stats[j].fragments);
+        }
+        for (int g = 0; g < complete.count; g++) {
+            buffer_printf(out, "%s* ", genes[complete.genes[g]].name);
+        }
+        for (int g = 0; g < partial.count; g++) {
+            buffer_printf(out, "%s ", genes[partial.genes[g]].name);
+        }
+        buffer_printf(out, "\n");
+    }
+    free(hits);
+    free(complete.genes);
+    free(partial.genes);
+}
+
+static void *overlap_worker(void *arg) {
+    OverlapJob *job = (OverlapJob *)arg;
+    int chunk;
+    while ((chunk = __atomic_fetch_add(&job->next_chunk, 1, __ATOMIC_RELAXED)) < job->chunk_count) {
+        int begin = chunk * ALIGNMENT_CHUNK;
+        int end = min(begin + ALIGNMENT_CHUNK, job->alignment_count);
+        classify_alignments(job, begin, end, job->chunks ? &job->chunks[chunk] : NULL, job->coverage ? &job->coverage[chunk] : NULL,
+                            job->gene_lists ? &job->gene_lists[chunk] : NULL);
+    }
+    return NULL;
+}
+
+// Look up the gene indexes of every query ID once
+static QueryIndex *build_query_indexes(const GeneIndexMap *indexes, const AlignmentSet *alignments) {
+    QueryIndex *query_indexes = (QueryIndex *)malloc((alignments->ids.count > 0 ? alignments->ids.count : 1) * sizeof(QueryIndex));
+    if (query_indexes == NULL) {
+        fprintf(stderr, "Error allocating memory for gene index\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int id = 0; id < alignments->ids.count; id++) {
+        query_indexes[id] = lookup_gene_index(indexes, alignments->ids.strings[id]);
+    }
+    return query_indexes;
+}
+
+// Classify every alignment on up to threads workers; outputs (OVERLAP_*) selects the per-chunk
+// rows, coverage segments and gene lists to produce, allocated here
+static void run_overlap_job(OverlapJob *job, int threads, int outputs) {
+    // Alignments are independent: workers take chunks in any order, the chunks are written in input order
+    job->chunk_count = (job->alignment_count + ALIGNMENT_CHUNK - 1) / ALIGNMENT_CHUNK;
+    size_t chunk_slots = job->chunk_count > 0 ? job->chunk_count : 1;
+    job->chunks = (outputs & OVERLAP_ROWS) ? (OutputBuffer *)calloc(chunk_slots, sizeof(OutputBuffer)) : NULL;
+    job->coverage = (outputs & OVERLAP_COVERAGE) ? (CoverageList *)calloc(chunk_slots, sizeof(CoverageList)) : NULL;
+    job->gene_lists = (outputs & OVERLAP_GENE_LISTS) ? (GeneColumn *)calloc(chunk_slots, sizeof(GeneColumn)) : NULL;
+    job->next_chunk = 0;
+    if (((outputs & OVERLAP_ROWS) && job->chunks == NULL) || ((outputs & OVERLAP_COVERAGE) && job->coverage == NULL) ||
+        ((outputs & OVERLAP_GENE_LISTS) && job->gene_lists == NULL)) {
+        fprintf(stderr, "Error allocating memory for output\n");
+        exit(EXIT_FAILURE);
+    }
+
+    threads = min(threads, max(job->chunk_count, 1));
+    pthread_t *workers = (pthread_t *)malloc(threads * sizeof(pthread_t));
+    for (int t = 1; t < threads; t++) {
+        if (pthread_create(&workers[t], NULL, overlap_worker, job) != 0) {
+            fprintf(stderr, "Error creating worker thread\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    overlap_worker(job);
+    for (int t = 1; t < threads; t++) {
+        pthread_join(workers[t], NULL);
+    }
+    free(workers);
+}
+
+static void write_header(FILE *file, int with_pair, int merged) {
+    fprintf(file, "%sNo\tQuery\tSubject\tIdentity\tlength\tq.start\tq.end\ts.start\ts.end\t%sHGT gene\n",
+            with_pair ? "Pair\t" : "", merged ? "Fragments\t" : "");
+}
+
+static void column_flush(ColumnWriter *writer) {
+    if (writer->length > 0 && fwrite(writer->buffer, 1, writer->length, writer->file) != writer->length) {
+        fprintf(stderr, "Error writing columnar output\n");
+        exit(EXIT_FAILURE);
+    }
+    writer->length = 0;
+}
+
+static void column_write(ColumnWriter *writer, const void *data, size_t length) {
+    writer->offset += length;
+    if (length >= COLUMNAR_BUFFER) {
+        column_flush(writer);
+        if (fwrite(data, 1, length, writer->file) != length) {
+            fprintf(stderr, "Error writing columnar output\n");
+            exit(EXIT_FAILURE);
+        }
+        return;
+    }
+    if (writer->length + length > COLUMNAR_BUFFER) {
+        column_flush(writer);
+    }
+    memcpy(writer->buffer + writer->length, data, length);
+    writer->length += length;
+}
+
+// count values of width bytes each, stored little-endian
+static void column_write_values(ColumnWriter *writer, const void *data, size_t count, int width) {
+    if (!COLUMNAR_SWAP || width == 1) {
+        column_write(writer, data, count * width);
+        return;
+    }
+    const unsigned char *values = (const unsigned char *)data;
+    unsigned char value[8];
+    for (size_t i = 0; i < count; i++) {
+        for (int b = 0; b < width; b++) {
+            value[b] = values[i * width + width - 1 - b];
+        }
+        column_write(writer, value, width);
+    }
+}
+
+// Pad to the next multiple of 8, where every column starts
+static void column_align(ColumnWriter *writer) {
+    static const char zeros[8] = {0};
+    if (writer->offset % 8 != 0) {
+        column_write(writer, zeros, 8 - writer->offset % 8);
+    }
+}
+
+static void add_column(ColumnEntry *columns, int *column_count, uint64_t *offset, const char *name, uint32_t type, uint64_t count) {
+    static const int widths[] = {1, 4, 4, 4, 8};
+    ColumnEntry *column = &columns[(*column_count)++];
+    memset(column, 0, sizeof(ColumnEntry));
+    strncpy(column->name, name, sizeof(column->name) - 1);
+    column->type = type;
+    column->offset = *offset;
+    column->count = count;
+    *offset = (*offset + count * widths[type] + 7) / 8 * 8;
+}
+
+// One 4-byte field of every row, gathered through the staging buffer
+static void write_row_column(ColumnWriter *writer, const AlignmentSet *alignments, size_t field) {
+    for (int i = 0; i < alignments->count; i++) {
+        column_write_values(writer, (const char *)&alignments->rows[i] + field, 1, 4);
+    }
+    column_align(writer);
+}
+
+static void write_string_columns(ColumnWriter *writer, char **strings, int count) {
+    uint64_t offset = 0;
+    for (int i = 0; i < count; i++) {
+        column_write_values(writer, &offset, 1, sizeof(offset));
+        offset += strlen(strings[i]);
+    }
+    column_write_values(writer, &offset, 1, sizeof(offset));
+    column_align(writer);
+    for (int i = 0; i < count; i++) {
+        column_write(writer, strings[i], strlen(strings[i]));
+    }
+    column_align(writer);
+}
+
+// Write the rows of the output table as typed columns (layout in README.md): a header, a column
+// directory, then each column as one little-endian array starting on an 8-byte boundary
+void write_columnar(const char *filename, Gene *genes, int gene_count, const AlignmentSet *alignments, GeneColumn *gene_lists, int chunk_count) {
+    FILE *file = fopen(filename, "wb");
+    if (file == NULL) {
+        fprintf(stderr, "Error opening columnar output file: %s\n", filename);
+        exit(EXIT_FAILURE);
+    }
+
+    uint64_t gene_total = 0, id_bytes = 0, name_bytes = 0;
+    for (int c = 0; c < chunk_count; c++) {
+        gene_total += gene_lists[c].count;
+    }
+    for (int i = 0; i < alignments->ids.count; i++) {
+        id_bytes += strlen(alignments->ids.strings[i]);
+    }
+    for (int i = 0; i < gene_count; i++) {
+        name_bytes += strlen(genes[i].name);
+    }
+
+    // The directory is written first, so every column's place is worked out from the counts
+    static const struct { const char *name; size_t field; uint32_t type; } row_columns[] = {
+        {"query", offsetof(Blastn, query), COLUMN_U32},
+        {"subject", offsetof(Blastn, subject), COLUMN_U32},
+        {"identity", offsetof(Blastn, identity), COLUMN_F32},
+        {"length", offsetof(Blastn, alignment_length), COLUMN_I32},
+        {"q_start", offsetof(Blastn, q_start), COLUMN_I32},
+        {"q_end", offsetof(Blastn, q_end), COLUMN_I32},
+        {"s_start", offsetof(Blastn, s_start), COLUMN_I32},
+        {"s_end", offsetof(Blastn, s_end), COLUMN_I32},
+    };
+    int row_column_count = sizeof(row_columns) / sizeof(row_columns[0]);
+    ColumnEntry columns[20];
+    int column_count = 0;
+    int directory_count = row_column_count + (alignments->merged ? 1 : 0) + 9;
+    uint64_t offset = (24 + directory_count * sizeof(ColumnEntry) + 7) / 8 * 8;
+    uint64_t rows = alignments->count;
+    for (int i = 0; i < row_column_count; i++) {
+        add_column(columns, &column_count, &offset, row_columns[i].name, row_columns[i].type, rows);
+    }
+    if (alignments->merged) {
+        add_column(columns, &column_count, &offset, "fragments", COLUMN_I32, rows);
+    }
+    add_column(columns, &column_count, &offset, "gene_offsets", COLUMN_U64, rows + 1);
+    add_column(columns, &column_count, &offset, "genes", COLUMN_U32, gene_total);
+    add_column(columns, &column_count, &offset, "gene_complete", COLUMN_U8, gene_total);
+    add_column(columns, &column_count, &offset, "id_offsets", COLUMN_U64, alignments->ids.count + 1);
+    add_column(columns, &column_count, &offset, "id_data", COLUMN_U8, id_bytes);
+    add_column(columns, &column_count, &offset, "name_offsets", COLUMN_U64, gene_count + 1);
+    add_column(columns, &column_count, &offset, "name_data", COLUMN_U8, name_bytes);
+    add_column(columns, &column_count, &offset, "gene_start", COLUMN_I32, gene_count);
+    add_column(columns, &column_count, &offset, "gene_end", COLUMN_I32, gene_count);
+
+    ColumnWriter writer = {file, (char *)malloc(COLUMNAR_BUFFER), 0, 0};
+    if (writer.buffer == NULL) {
+        fprintf(stderr, "Error allocating memory for columnar output\n");
+        exit(EXIT_FAILURE);
+    }
+    uint32_t version = COLUMNAR_VERSION, count32 = column_count;
+    column_write(&writer, COLUMNAR_MAGIC, 8);
+    column_write_values(&writer, &version, 1, sizeof(version));
+    column_write_values(&writer, &count32, 1, sizeof(count32));
+    column_write_values(&writer, &rows, 1, sizeof(rows));
+    for (int i = 0; i < column_count; i++) {
+        column_write(&writer, columns[i].name, sizeof(columns[i].name));
+        column_write_values(&writer, &columns[i].type, 1, sizeof(columns[i].type));
+        column_write_values(&writer, &columns[i].reserved, 1, sizeof(columns[i].reserved));
+        column_write_values(&writer, &columns[i].offset, 1, sizeof(columns[i].offset));
+        column_write_values(&writer, &columns[i].count, 1, sizeof(columns[i].count));
+    }
+    column_align(&writer);
+
+    for (int i = 0; i < row_column_count; i++) {
+        write_row_column(&writer, alignments, row_columns[i].field);
+    }
+    if (alignments->merged) {
+        for (int i = 0; i < alignments->count; i++) {
+            column_write_values(&writer, &alignments->stats[i].fragments, 1, 4);
+        }
+        column_align(&writer);
+    }
+
+    uint64_t listed = 0;
+    for (int c = 0; c < chunk_count; c++) {
+        int chunk_rows = min(ALIGNMENT_CHUNK, alignments->count - c * ALIGNMENT_CHUNK);
+        for (int r = 0; r < chunk_rows; r++) {
+            column_write_values(&writer, &listed, 1, sizeof(listed));
+            listed += gene_lists[c].counts[r];
+        }
+    }
+    column_write_values(&writer, &listed, 1, sizeof(listed));
+    column_align(&writer);
+    for (int c = 0; c < chunk_count; c++) {
+        column_write_values(&writer, gene_lists[c].genes, gene_lists[c].count, sizeof(int));
+    }
+    column_align(&writer);
+    for (int c = 0; c < chunk_count; c++) {
+        column_write(&writer, gene_lists[c].complete, gene_lists[c].count);
+    }
+    column_align(&writer);
+
+    write_string_columns(&writer, alignments->ids.strings, alignments->ids.count);
+    char **names = (char **)malloc((gene_count > 0 ? gene_count : 1) * sizeof(char *));
+    for (int i = 0; i < gene_count; i++) {
+        names[i] = genes[i].name;
+    }
+    write_string_columns(&writer, names, gene_count);
+    free(names);
+    for (int i = 0; i < gene_count; i++) {
+        column_write_values(&writer, &genes[i].start, 1, 4);
+    }
+    column_align(&writer);
+    for (int i = 0; i < gene_count; i++) {
+        column_write_values(&writer, &genes[i].end, 1, 4);
+    }
+    column_align(&writer);
+
+    column_flush(&writer);
+    free(writer.buffer);
+    fclose(file);
+}
+
+void find_transfer_genes(Gene *genes, int gene_count, const AlignmentSet *alignments, const char *output_file, const char *coverage_file, const char *columnar_file, int threads) {
+    FILE *file = NULL;
+    if (output_file != NULL) {
+        file = fopen(output_file, "w");
+        if (file == NULL) {
+            fprintf(stderr, "Error opening output file: %s\n", output_file);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // Only genes on the query sequence that intersect an alignment can be complete or partial,
+    // so each alignment looks those up in the index of its own query
+    GeneIndexMap *indexes = build_gene_index_map(genes, gene_count);
+    QueryIndex *query_indexes = build_query_indexes(indexes, alignments);
+
+    OverlapJob job;
+    job.genes = genes;
+    job.alignments = alignments;
+    job.alignment_count = alignments->count;
+    job.query_indexes = query_indexes;
+    job.pair = NULL;
+    run_overlap_job(&job, threads, (file != NULL ? OVERLAP_ROWS : 0) | (coverage_file != NULL ? OVERLAP_COVERAGE : 0) |
+                                   (columnar_file != NULL ? OVERLAP_GENE_LISTS : 0));
+
+    if (file != NULL) {
+        write_header(file, 0, alignments->merged);
+        for (int c = 0; c < job.chunk_count; c++) {
+            fwrite(job.chunks[c].data, 1, job.chunks[c].length, file);
+            free(job.chunks[c].data);
+        }
+        free(job.chunks);
+        fclose(file);
+    }
+    if (columnar_file != NULL) {
+        write_columnar(columnar_file, genes, gene_count, alignments, job.gene_lists, job.chunk_count);
+        for (int c = 0; c < job.chunk_count; c++) {
+            free(job.gene_lists[c].counts);
+            free(job.gene_lists[c].genes);
+            free(job.gene_lists[c].complete);
+        }
+        free(job.gene_lists);
+    }
+
+    free(query_indexes);
+    free_gene_index_map(indexes);
+
+    if (coverage_file) {
+        write_gene_coverage(genes, gene_count, job.coverage, job.chunk_count, coverage_file);
+        free(job.coverage);
+    }
+}
+
+static int compare_segments(const void *a, const void *b) {
+    const CoverageSegment *x = (const CoverageSegment *)a;
+    const CoverageSegment *y = (const CoverageSegment *)b;
+    if (x->gene != y->gene) return x->gene < y->gene ? -1 : 1;
+    return (x->lo > y->lo) - (x->lo < y->lo);
+}
+
+// One row per gene: bases covered by the union of its alignments, supporting alignments and best identity
+void write_gene_coverage(Gene *genes, int gene_count, CoverageList *lists, int list_count, const char *coverage_file) {
+    FILE *file = fopen(coverage_file, "w");
+    if (file == NULL) {
+        fprintf(stderr, "Error opening coverage file: %s\n", coverage_file);
+        exit(EXIT_FAILURE);
+    }
+
+    int total = 0;
+    for (int c = 0; c < list_count; c++) {
+        total += lists[c].count;
+    }
+    CoverageSegment *segments = (CoverageSegment *)malloc((total > 0 ? total : 1) * sizeof(CoverageSegment));
+    if (segments == NULL) {
+        fprintf(stderr, "Error allocating memory for gene coverage\n");
+        exit(EXIT_FAILURE);
+    }
+    total = 0;
+    for (int c = 0; c < list_count; c++) {
+        memcpy(segments + total, lists[c].segments, lists[c].count * sizeof(CoverageSegment));
+        total += lists[c].count;
+        free(lists[c].segments);
+    }
+    qsort(segments, total, sizeof(CoverageSegment), compare_segments);
+
+    fprintf(file, "Gene\tSeqID\tStart\tEnd\tLength\tCovered\tCoverage\tHSPs\tBest identity\n");
+    int s = 0;
+    for (int i = 0; i < gene_count; i++) {
+        int lo = min(genes[i].start, genes[i].end);
+        int hi = max(genes[i].start, genes[i].end);
+        int covered = 0, hsps = 0;
+        float best_identity = 0.0f;
+
+        // segments are sorted by start: sweep them, merging overlapping ones
+        int run_lo = 0, run_hi = -1;
+        for (; s < total && segments[s].gene == i; s++) {
+            hsps++;
+            best_identity = max(best_identity, segments[s].identity);
+            if (segments[s].lo > run_hi + 1 || run_hi < run_lo) {
+                if (run_hi >= run_lo) covered += run_hi - run_lo + 1;
+                run_lo = segments[s].lo;
+                run_hi = segments[s].hi;
+            } else {
+                run_hi = max(run_hi, segments[s].hi);
+            }
+        }
+        if (run_hi >= run_lo) covered += run_hi - run_lo + 1;
+
+        fprintf(file, "%s\t%s\t%d\t%d\t%d\t%d\t%.4f\t%d\t%.2f\n",
+                genes[i].name,
+                genes[i].seqid ? genes[i].seqid : "-",
+                genes[i].start,
+                genes[i].end,
+                hi - lo + 1,
+                covered,
+                (double)covered / (hi - lo + 1),
+                hsps,
+                best_identity);
+    }
+
+    free(segments);
+    fclose(file);
+}
+
+static int is_genbank_path(const char *path) {
+    const char *dot = strrchr(path, '.');
+    return dot != NULL && (strcmp(dot, ".gb") == 0 || strcmp(dot, ".gbk") == 0 || strcmp(dot, ".gbff") == 0 ||
+                           strcmp(dot, ".genbank") == 0);
+}
+
+// Read the manifest: pair name, alignment file, location (or genbank) file and an optional output file
+// per line. Location files are interned, so pairs sharing one share its cache entry
+void read_manifest(const char *filename, ManifestJob *job) {
+    InputBuffer in;
+    if (open_input(filename, "manifest", &in) != 0) {
+        exit(EXIT_FAILURE);
+    }
+
+    int capacity = 64;
+    StringTable paths = {NULL, 0, 0, NULL, 0};
+    job->pair_count = 0;
+    job->pairs = (ManifestPair *)malloc(capacity * sizeof(ManifestPair));
+    if (job->pairs == NULL) {
+        fprintf(stderr, "Error allocating memory for manifest\n");
+        exit(EXIT_FAILURE);
+    }
+
+    const char *p = in.data, *end = in.data + in.length;
+    int line = 0;
+    while (p < end) {
+        const char *eol = memchr(p, '\n', end - p);
+        if (eol == NULL) eol = end;
+        const char *line_end = (eol > p && eol[-1] == '\r') ? eol - 1 : eol;
+        line++;
+
+        const char *fields[4];
+        int lengths[4] = {0};
+        int n = p[0] == '#' ? 0 : split_fields(p, line_end, fields, lengths, 4);
+        if (n > 0 && n < 3) {
+            fprintf(stderr, "Error: Manifest line %d needs a pair name, an alignment file and a location file\n", line);
+            exit(EXIT_FAILURE);
+        }
+        if (n >= 3) {
+            if (job->pair_count == capacity) {
+                capacity *= 2;
+                job->pairs = (ManifestPair *)realloc(job->pairs, capacity * sizeof(ManifestPair));
+                if (job->pairs == NULL) {
+                    fprintf(stderr, "Error allocating memory for manifest\n");
+                    exit(EXIT_FAILURE);
+                }
+            }
+            ManifestPair *pair = &job->pairs[job->pair_count++];
+            memset(pair, 0, sizeof(ManifestPair));
+            pair->name = copy_field(fields[0], lengths[0]);
+            pair->alignment_file = copy_field(fields[1], lengths[1]);
+            pair->location = intern_string(&paths, fields[2], lengths[2]);
+            pair->output_file = n > 3 ? copy_field(fields[3], lengths[3]) : NULL;
+            if (pair->name == NULL || pair->alignment_file == NULL || pair->location < 0 || (n > 3 && pair->output_file == NULL)) {
+                exit(EXIT_FAILURE);
+            }
+        }
+        p = eol + 1;
+    }
+    close_input(&in);
+
+    job->location_count = paths.count;
+    job->locations = (LocationEntry *)calloc(paths.count > 0 ? paths.count : 1, sizeof(LocationEntry));
+    if (job->locations == NULL) {
+        fprintf(stderr, "Error allocating memory for manifest\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < paths.count; i++) {
+        job->locations[i].path = paths.strings[i];
+        pthread_mutex_init(&job->locations[i].lock, NULL);
+    }
+    free(paths.strings);
+    free(paths.slots);
+}
+
+// Return the genes and gene index of a location file, loading it on first use; NULL when it cannot be read
+static LocationEntry *load_location(LocationEntry *entry) {
+    pthread_mutex_lock(&entry->lock);
+    if (!entry->loaded) {
+        int loaded = is_genbank_path(entry->path) ? read_genbank_genes(entry->path, &entry->genes, &entry->gene_count)
+                                                  : read_genes(entry->path, &entry->genes, &entry->gene_count);
+        entry->failed = loaded != 0;
+        if (entry->failed) {
+            entry->error = strdup(input_error);
+        } else {
+            entry->indexes = build_gene_index_map(entry->genes, entry->gene_count);
+        }
+        entry->loaded = 1;
+        if (verbosity >= 1 && !entry->failed) {
+            fprintf(stderr, "Loaded %d genes from %s\n", entry->gene_count, entry->path);
+        }
+    }
+    pthread_mutex_unlock(&entry->lock);
+    return entry->failed ? NULL : entry;
+}
+
+// Write the finished pairs at the head of the manifest to the combined table, in manifest order
+static void flush_pairs(ManifestJob *job) {
+    while (job->next_write < job->pair_count && job->pairs[job->next_write].done) {
+        OutputBuffer *rows = &job->pairs[job->next_write].rows;
+        if (job->combined != NULL && rows->length > 0) {
+            fwrite(rows->data, 1, rows->length, job->combined);
+        }
+        free(rows->data);
+        rows->data = NULL;
+        job->next_write++;
+    }
+}
+
+// Report a pair that could not be run and count it as written, so the pairs after it are not held back
+static void fail_pair(ManifestJob *job, ManifestPair *pair, const char *reason) {
+    fprintf(stderr, "Error: Pair %s failed: %s\n", pair->name, reason);
+    pthread_mutex_lock(&job->write_lock);
+    pair->rows.length = 0;
+    pair->failed = 1;
+    pair->done = 1;
+    flush_pairs(job);
+    pthread_mutex_unlock(&job->write_lock);
+}
+
+static void process_pair(ManifestJob *job, ManifestPair *pair) {
+    LocationEntry *location = load_location(&job->locations[pair->location]);
+    if (location == NULL) {
+        const char *error = job->locations[pair->location].error;
+        fail_pair(job, pair, error != NULL ? error : "cannot read location file");
+        return;
+    }
+    AlignmentSet alignments;
+    if (read_alignments(pair->alignment_file, job->format, job->filters, &alignments) != 0) {
+        fail_pair(job, pair, input_error);
+        return;
+    }
+    if (job->merge_gap >= 0) {
+        merge_alignments(&alignments, job->merge_gap);
+    }
+
+    QueryIndex *query_indexes = build_query_indexes(location->indexes, &alignments);
+    OverlapJob overlap;
+    overlap.genes = location->genes;
+    overlap.alignments = &alignments;
+    overlap.alignment_count = alignments.count;
+    overlap.query_indexes = query_indexes;
+
+    // Rows of the pair's own file have no pair column; the combined table's rows start with one
+    overlap.pair = pair->output_file == NULL ? pair->name : NULL;
+    run_overlap_job(&overlap, 1, OVERLAP_ROWS);
+    FILE *file = NULL;
+    if (pair->output_file != NULL) {
+        file = fopen(pair->output_file, "w");
+        if (file == NULL) {
+            for (int c = 0; c < overlap.chunk_count; c++) {
+                free(overlap.chunks[c].data);
+            }
+            free(overlap.chunks);
+            free(query_indexes);
+            free_alignments(&alignments);
+            char reason[MAX_LINE_LENGTH];
+            snprintf(reason, sizeof(reason), "cannot open output file %s", pair->output_file);
+            fail_pair(job, pair, reason);
+            return;
+        }
+        write_header(file, 0, alignments.merged);
+    }
+    for (int c = 0; c < overlap.chunk_count; c++) {
+        OutputBuffer *chunk = &overlap.chunks[c];
+        if (file != NULL) {
+            fwrite(chunk->data, 1, chunk->length, file);
+        }
+        if (job->combined != NULL && overlap.pair != NULL) {
+            buffer_printf(&pair->rows, "%.*s", (int)chunk->length, chunk->data ? chunk->data : "");
+        } else if (job->combined != NULL) {
+            for (const char *line = chunk->data, *end = chunk->data + chunk->length; line < end;) {
+                const char *eol = memchr(line, '\n', end - line);
+                buffer_printf(&pair->rows, "%s\t%.*s\n", pair->name, (int)(eol - line), line);
+                line = eol + 1;
+            }
+        }
+        free(chunk->data);
+    }
+    free(overlap.chunks);
+    if (file != NULL) {
+        fclose(file);
+    }
+    if (verbosity >= 1) {
+        fprintf(stderr, "Pair %s: %d alignments\n", pair->name, alignments.count);
+    }
+
+    free(query_indexes);
+    free_alignments(&alignments);
+
+    pthread_mutex_lock(&job->write_lock);
+    pair->done = 1;
+    flush_pairs(job);
+    pthread_mutex_unlock(&job->write_lock);
+}
+
+static void *manifest_worker(void *arg) {
+    ManifestJob *job = (ManifestJob *)arg;
+    int pair;
+    while ((pair = __atomic_fetch_add(&job->next_pair, 1, __ATOMIC_RELAXED)) < job->pair_count) {
+        process_pair(job, &job->pairs[pair]);
+    }
+    return NULL;
+}
+
+// Run every pair of the manifest on a pool of threads, one pair per worker at a time. A pair whose
+// files cannot be read is reported and left out; returns the number of such pairs
+int run_manifest(const char *manifest_file, const char *output_file, int threads, int format, const Filters *filters, int merge_gap) {
+    ManifestJob job;
+    read_manifest(manifest_file, &job);
+    report_input_errors = 0;
+    job.format = format;
+    job.filters = filters;
+    job.merge_gap = merge_gap;
+    job.next_pair = 0;
+    job.next_write = 0;
+    job.combined = NULL;
+    pthread_mutex_init(&job.write_lock, NULL);
+
+    for (int i = 0; i < job.pair_count; i++) {
+        if (output_file == NULL && job.pairs[i].output_file == NULL) {
+            fprintf(stderr, "Error: Pair %s has no output file and no combined output (-o) was given\n", job.pairs[i].name);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (output_file != NULL) {
+        job.combined = fopen(output_file, "w");
+        if (job.combined == NULL) {
+            fprintf(stderr, "Error opening output file: %s\n", output_file);
+            exit(EXIT_FAILURE);
+        }
+        write_header(job.combined, 1, merge_gap >= 0);
+    }
+
+    threads = min(threads, max(job.pair_count, 1));
+    pthread_t *workers = (pthread_t *)malloc(threads * sizeof(pthread_t));
+    for (int t = 1; t < threads; t++) {
+        if (pthread_create(&workers[t], NULL, manifest_worker, &job) != 0) {
+            fprintf(stderr, "Error creating worker thread\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    manifest_worker(&job);
+    for (int t = 1; t < threads; t++) {
+        pthread_join(workers[t], NULL);
+    }
+    free(workers);
+
+    if (job.combined != NULL) {
+        fclose(job.combined);
+    }
+    int failed = 0;
+    for (int i = 0; i < job.pair_count; i++) {
+        failed += job.pairs[i].failed;
+    }
+    if (failed > 0) {
+        fprintf(stderr, "Error: %d of %d pairs failed\n", failed, job.pair_count);
+    }
+    for (int i = 0; i < job.pair_count; i++) {
+        free(job.pairs[i].name);
+        free(job.pairs[i].alignment_file);
+        free(job.pairs[i].output_file);
+    }
+    for (int i = 0; i < job.location_count; i++) {
+        LocationEntry *entry = &job.locations[i];
+        if (entry->loaded && !entry->failed) {
+            free_gene_index_map(entry->indexes);
+            free_genes(entry->genes, entry->gene_count);
+        }
+        pthread_mutex_destroy(&entry->lock);
+        free(entry->path);
+        free(entry->error);
+    }
+    pthread_mutex_destroy(&job.write_lock);
+    free(job.pairs);
+    free(job.locations);
+    return failed;
+}
+
+// Serve mode: answer overlap requests over a Unix domain socket, keeping gene indexes in memory.
+// Every message is a 4-byte big-endian length followed by that many bytes. A request is one line of
+// tab-separated fields; the reply starts with "OK\n" or "ERROR <reason>\n"
+#define DEFAULT_SERVE_CACHE 64
+#define MAX_REQUEST_LENGTH (1 << 20)
+
+// Define a struct to hold a location file kept by the server, identified by its path and file state
+typedef struct {
+    char *path;
+    time_t mtime;
+    off_t size;
+    Gene *genes;
+    int gene_count;
+    GeneIndexMap *indexes;
+    unsigned long last_used;
+} ServedLocation;
+
+// Define a struct to hold the server's location files, evicting the least recently used one when full
+typedef struct {
+    ServedLocation *locations;
+    int count;
+    int capacity;
+    unsigned long clock;
+    unsigned long hits;
+    unsigned long misses;
+} LocationCache;
+
+static void free_served_location(ServedLocation *location) {
+    free_genes(location->genes, location->gene_count);
+    free_gene_index_map(location->indexes);
+    free(location->path);
+}
+
+// Return the genes and index of a location (or genbank) file, reading it on a miss or when it changed;
+// NULL, with the reason in input_error, when the file does not exist or cannot be read. A file that
+// fails to load is not kept in the cache
+static ServedLocation *location_cache_get(LocationCache *cache, const char *path) {
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        snprintf(input_error, sizeof(input_error), "%s does not exist", path);
+        return NULL;
+    }
+
+    ServedLocation *slot = NULL;
+    for (int i = 0; i < cache->count; i++) {
+        if (strcmp(cache->locations[i].path, path) == 0) {
+            if (cache->locations[i].mtime == st.st_mtime && cache->locations[i].size == st.st_size) {
+                cache->locations[i].last_used = ++cache->clock;
+                cache->hits++;
+                return &cache->locations[i];
+            }
+            free_served_location(&cache->locations[i]);
+            slot = &cache->locations[i];
+            break;
+        }
+    }
+    if (slot == NULL && cache->count < cache->capacity) {
+        slot = &cache->locations[cache->count++];
+    } else if (slot == NULL) {
+        slot = &cache->locations[0];
+        for (int i = 1; i < cache->count; i++) {
+            if (cache->locations[i].last_used < slot->last_used) {
+                slot = &cache->locations[i];
+            }
+        }
+        free_served_location(slot);
+    }
+
+    cache->misses++;
+    slot->path = copy_field(path, strlen(path));
+    slot->mtime = st.st_mtime;
+    slot->size = st.st_size;
+    slot->last_used = ++cache->clock;
+    int loaded = slot->path == NULL ? -1
+               : is_genbank_path(path) ? read_genbank_genes(path, &slot->genes, &slot->gene_count)
+                                       : read_genes(path, &slot->genes, &slot->gene_count);
+    if (loaded != 0) {
+        free(slot->path);
+        *slot = cache->locations[--cache->count];
+        return NULL;
+    }
+    slot->indexes = build_gene_index_map(slot->genes, slot->gene_count);
+    return slot;
+}
+
+// overlap <location_file> <alignment_file> [blast6|paf]: the output table of a single run
+static void serve_overlap(LocationCache *cache, char **fields, int field_count, FILE *reply) {
+    int format = field_count > 3 && strcmp(fields[3], "paf") == 0 ? FORMAT_PAF : FORMAT_BLAST6;
+    struct stat st;
+    if (stat(fields[2], &st) != 0) {
+        fprintf(reply, "ERROR %s does not exist\n", fields[2]);
+        return;
+    }
+    ServedLocation *location = location_cache_get(cache, fields[1]);
+    if (location == NULL) {
+        fprintf(reply, "ERROR %s\n", input_error);
+        return;
+    }
+
+    Filters filters = {0.0f, 0, -1.0, 0.0f};
+    AlignmentSet alignments;
+    if (read_alignments(fields[2], format, &filters, &alignments) != 0) {
+        fprintf(reply, "ERROR %s\n", input_error);
+        return;
+    }
+    QueryIndex *query_indexes = build_query_indexes(location->indexes, &alignments);
+    OverlapJob job;
+    job.genes = location->genes;
+    job.alignments = &alignments;
+    job.alignment_count = alignments.count;
+    job.query_indexes = query_indexes;
+    job.pair = NULL;
+    run_overlap_job(&job, 1, OVERLAP_ROWS);
+
+    fprintf(reply, "OK\n");
+    write_header(reply, 0, 0);
+    for (int c = 0; c < job.chunk_count; c++) {
+        fwrite(job.chunks[c].data, 1, job.chunks[c].length, reply);
+        free(job.chunks[c].data);
+    }
+    free(job.chunks);
+    free(query_indexes);
+    free_alignments(&alignments);
+}
+
+// A 1-based coordinate of a request; returns 0 unless the whole field is one
+static int parse_coordinate(const char *field, int *value) {
+    char *end;
+    errno = 0;
+    long parsed = strtol(field, &end, 10);
+    if (end == field || *end != '\0' || errno == ERANGE || parsed < 1 || parsed > INT_MAX) {
+        return 0;
+    }
+    *value = (int)parsed;
+    return 1;
+}
+
+// genes <location_file> <seqid|-> <start> <end>: the genes a range overlaps, marked '*' when it contains them
+static void serve_genes(LocationCache *cache, char **fields, FILE *reply) {
+    int start, end;
+    if (!parse_coordinate(fields[3], &start) || !parse_coordinate(fields[4], &end)) {
+        fprintf(reply, "ERROR invalid range\n");
+        return;
+    }
+    ServedLocation *location = location_cache_get(cache, fields[1]);
+    if (location == NULL) {
+        fprintf(reply, "ERROR %s\n", input_error);
+        return;
+    }
+    int lo = min(start, end), hi = max(start, end);
+    QueryIndex query = lookup_gene_index(location->indexes, strcmp(fields[2], "-") == 0 ? NULL : fields[2]);
+    int *hits = NULL, hits_capacity = 0;
+    int hit_count = query_genes(&query, lo, hi, &hits, &hits_capacity);
+
+    fprintf(reply, "OK\n");
+    for (int h = 0; h < hit_count; h++) {
+        const Gene *gene = &location->genes[hits[h]];
+        int complete = min(gene->start, gene->end) >= lo && max(gene->start, gene->end) <= hi;
+        fprintf(reply, "%s%s\t%d\t%d\t%d\n", gene->name, complete ? "*" : "", gene->start, gene->end, gene->strand);
+    }
+    free(hits);
+}
+
+static int read_full(int fd, void *buffer, size_t length) {
+    size_t done = 0;
+    while (done < length) {
+        ssize_t n = read(fd, (char *)buffer + done, length - done);
+        if (n <= 0) {
+            return 0;
+        }
+        done += n;
+    }
+    return 1;
+}
+
+static int write_full(int fd, const void *buffer, size_t length) {
+    size_t done = 0;
+    while (done < length) {
+        ssize_t n = write(fd, (const char *)buffer + done, length - done);
+        if (n <= 0) {
+            return 0;
+        }
+        done += n;
+    }
+    return 1;
+}
+
+// Read one length-prefixed message; returns NULL at end of connection or on an oversized message
+static char *read_message(int fd) {
+    unsigned char prefix[4];
+    if (!read_full(fd, prefix, 4)) {
+        return NULL;
+    }
+    uint32_t length = ((uint32_t)prefix[0] << 24) | ((uint32_t)prefix[1] << 16) | ((uint32_t)prefix[2] << 8) | prefix[3];
+    if (length > MAX_REQUEST_LENGTH) {
+        return NULL;
+    }
+    char *message = (char *)malloc(length + 1);
+    if (message == NULL || !read_full(fd, message, length)) {
+        free(message);
+        return NULL;
+    }
+    message[length] = '\0';
+    return message;
+}
+
+static int write_message(int fd, const char *data, size_t length) {
+    unsigned char prefix[4] = {(unsigned char)(length >> 24), (unsigned char)(length >> 16), (unsigned char)(length >> 8), (unsigned char)length};
+    return write_full(fd, prefix, 4) && write_full(fd, data, length);
+}
+
+// Answer one request; returns 0 when the server should stop
+static int serve_request(LocationCache *cache, char *request, FILE *reply) {
+    char *fields[16];
+    int field_count = 0;
+    request[strcspn(request, "\r\n")] = '\0';
+    for (char *field = strtok(request, "\t"); field != NULL && field_count < 16; field = strtok(NULL, "\t")) {
+        fields[field_count++] = field;
+    }
+
+    if (field_count == 0) {
+        fprintf(reply, "ERROR empty request\n");
+    } else if (strcmp(fields[0], "ping") == 0) {
+        fprintf(reply, "OK\npong\n");
+    } else if (strcmp(fields[0], "overlap") == 0 && field_count >= 3) {
+        serve_overlap(cache, fields, field_count, reply);
+    } else if (strcmp(fields[0], "genes") == 0 && field_count >= 5) {
+        serve_genes(cache, fields, reply);
+    } else if (strcmp(fields[0], "stats") == 0) {
+        fprintf(reply, "OK\nlocations\t%d\ncapacity\t%d\nhits\t%lu\nmisses\t%lu\n", cache->count, cache->capacity, cache->hits, cache->misses);
+    } else if (strcmp(fields[0], "shutdown") == 0) {
+        fprintf(reply, "OK\n");
+        return 0;
+    } else {
+        fprintf(reply, "ERROR unknown request '%s' (ping, overlap, genes, stats, shutdown)\n", fields[0]);
+    }
+    return 1;
+}
+
+// transfer_gene serve --socket <path> [--cache-size N]
+int serve(int argc, char *argv[]) {
+    const char *socket_path = NULL;
+    int cache_size = DEFAULT_SERVE_CACHE;
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--socket") == 0 && i + 1 < argc) {
+            socket_path = argv[++i];
+        } else if (strcmp(argv[i], "--cache-size") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0) {
+            cache_size = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-v") == 0 || strcmp(argv[i], "--verbose") == 0) {
+            verbosity++;
+        } else {
+            fprintf(stderr, "Error: Invalid serve option '%s'\n", argv[i]);
+            fprintf(stderr, "Usage: %s serve --socket <path> [--cache-size N] [-v]\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    struct sockaddr_un address;
+    if (socket_path == NULL || strlen(socket_path) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "Error: serve needs --socket <path> (at most %d characters)\n", (int)sizeof(address.sun_path) - 1);
+        exit(EXIT_FAILURE);
+    }
+
+    int server = socket(AF_UNIX, SOCK_STREAM, 0);
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, socket_path);
+    unlink(socket_path);
+    if (server < 0 || bind(server, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(server, 16) != 0) {
+        fprintf(stderr, "Error: Failed to listen on %s\n", socket_path);
+        exit(EXIT_FAILURE);
+    }
+    signal(SIGPIPE, SIG_IGN);
+    report_input_errors = 0;
+    if (verbosity >= 1) {
+        fprintf(stderr, "Serving on %s (cache of %d location files)\n", socket_path, cache_size);
+    }
+
+    LocationCache cache = {(ServedLocation *)calloc(cache_size, sizeof(ServedLocation)), 0, cache_size, 0, 0, 0};
+    int running = 1;
+    while (running) {
+        int client = accept(server, NULL, NULL);
+        if (client < 0) {
+            continue;
+        }
+        char *request;
+        while (running && (request = read_message(client)) != NULL) {
+            char *data = NULL;
+            size_t length = 0;
+            FILE *reply = open_memstream(&data, &length);
+            running = serve_request(&cache, request, reply);
+            fclose(reply);
+            int sent = write_message(client, data, length);
+            free(data);
+            free(request);
+            if (!sent) {
+                break;
+            }
+        }
+        close(client);
+    }
+
+    close(server);
+    unlink(socket_path);
+    for (int i = 0; i < cache.count; i++) {
+        free_served_location(&cache.locations[i]);
+    }
+    free(cache.locations);
+    return 0;
+}
+
+void free_memory(Gene *genes, int gene_count, AlignmentSet *alignments) {
+   free_genes(genes, gene_count);
+   free_alignments(alignments);
+}
+
+int main(int argc, char *argv[]) {
+   char *transfer_file = NULL;
+   char *location_file = NULL;
+   char *genbank_file = NULL;
+   char *output_file = NULL;
+   char *coverage_file = NULL;
+   char *columnar_file = NULL;
+   int threads = 1;
+   int format = FORMAT_BLAST6;
+   Filters filters = {0.0f, 0, -1.0, 0.0f};
+   FindOptions find = {0, NULL, NULL, NULL, DEFAULT_KMER};
+   int merge_gap = -1;
+   char *manifest_file = NULL;
+
+   if (argc > 1 && strcmp(argv[1], "serve") == 0) {
+       return serve(argc, argv);
+   }
+
+   parse_arguments(argc, argv, &transfer_file, &location_file, &genbank_file, &output_file, &coverage_file, &columnar_file, &threads, &format, &filters, &find, &merge_gap, &manifest_file);
 
-   parse_arguments(argc, argv, &transfer_file, &location_file, &output_file);
+   if (manifest_file != NULL) {
+       return run_manifest(manifest_file, output_file, threads, format, &filters, merge_gap) == 0 ? 0 : EXIT_FAILURE;
+   }
 
    Gene *genes = NULL;
    int gene_count = 0;
-   Blastn *alignments = NULL;
-   int alignment_count = 0;
+   AlignmentSet alignments;
 
-   read_genes(location_file, &genes, &gene_count);
-   read_blastn(transfer_file, &alignments, &alignment_count);
+   int loaded = genbank_file != NULL ? read_genbank_genes(genbank_file, &genes, &gene_count)
+                                     : read_genes(location_file, &genes, &gene_count);
+   if (loaded != 0) {
+       exit(EXIT_FAILURE);
+   }
+   if (verbosity >= 1) {
+       fprintf(stderr, "Read %d genes\n", gene_count);
+   }
+   if (find.enabled) {
+       find_alignments(find.donor_file, find.recipient_file, find.k, threads, &filters, &alignments);
+       if (find.hits_file != NULL) {
+           write_alignments(&alignments, find.hits_file);
+       }
+   } else if (read_alignments(transfer_file, format, &filters, &alignments) != 0) {
+       exit(EXIT_FAILURE);
+   }
+   if (verbosity >= 1) {
+       fprintf(stderr, "%s %d alignments\n", find.enabled ? "Found" : "Read", alignments.count);
+   }
+   if (merge_gap >= 0) {
+       merge_alignments(&alignments, merge_gap);
+       if (verbosity >= 1) {
+           fprintf(stderr, "Merged into %d blocks\n", alignments.count);
+       }
+   }
 
-   find_transfer_genes(genes, gene_count, alignments, alignment_count, output_file);
+   find_transfer_genes(genes, gene_count, &alignments, output_file, coverage_file, columnar_file, threads);
 
-   free_memory(genes, alignments);
+   free_memory(genes, gene_count, &alignments);
 
    return 0;
 }
\ No newline at end of file